@@ -0,0 +1,28 @@
+#ifndef CLIENT_EXC_H
+#define CLIENT_EXC_H
+
+#include <exception>
+
+class ClientExc : public std::exception {
+	const char *msg;
+  public:
+	ClientExc(const char *msg) : msg(msg) {}
+	virtual const char *what() const noexcept override { return msg; }
+};
+
+class ClientExcConnect : public ClientExc {
+  public:
+	ClientExcConnect(const char *msg) : ClientExc(msg) {}
+};
+
+class ClientExcProtocol : public ClientExc {
+  public:
+	ClientExcProtocol(const char *msg) : ClientExc(msg) {}
+};
+
+class ClientExcClosed : public ClientExc {
+  public:
+	ClientExcClosed(const char *msg) : ClientExc(msg) {}
+};
+
+#endif // CLIENT_EXC_H
@@ -0,0 +1,204 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <algorithm>
+#include "schedule_client.h"
+#include "../Transport/shm_ring.h"
+
+/* ------------------------------------------ScheduleReply--------------------------------------- */
+
+std::string_view ScheduleReply::RowIterator::operator*() const
+{
+	int len;
+	std::memcpy(&len, _pos, sizeof(len));
+	return std::string_view(_pos + sizeof(len), len);
+}
+
+ScheduleReply::RowIterator& ScheduleReply::RowIterator::operator++()
+{
+	int len;
+	std::memcpy(&len, _pos, sizeof(len));
+	_pos += sizeof(len) + len;
+	return *this;
+}
+
+ScheduleReply::ScheduleReply(std::string raw, size_t begin, size_t size) : _raw(std::move(raw)), _begin(begin)
+{
+	std::string_view reply(_raw.data() + _begin, size);
+	size_t pos = 0;
+	get_int(reply, pos, _code);
+	if (_code == PRINT_DATA || _code == PREPARED)
+		get_int(reply, pos, _value);
+	_body = _begin + pos;
+}
+
+std::string_view ScheduleReply::error() const
+{
+	return _code == ERROR ? *RowIterator(_raw.data() + _body) : std::string_view();
+}
+
+ScheduleReply::RowIterator ScheduleReply::begin() const
+{
+	return RowIterator(_raw.data() + _body);
+}
+
+ScheduleReply::RowIterator ScheduleReply::end() const
+{
+	RowIterator it = begin();
+	for (size_t i = 0; i < size(); ++i)
+		++it;
+	return it;
+}
+
+/* ------------------------------------------ScheduleClient-------------------------------------- */
+
+void ScheduleClient::send_all(std::string_view data)
+{
+	while (!data.empty()) {
+		ssize_t sent = ::send(_fd, data.data(), data.size(), MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			throw ClientExcClosed("Cannot send the query to the server!");
+		data.remove_prefix(sent);
+	}
+}
+
+void ScheduleClient::fill()
+{
+	if (_start == _used) {
+		_start = _used = 0;
+	} else if (_start > 0 && _in.size() - _used < CLIENT_RECV_CHUNK) {
+		std::memmove(_in.data(), _in.data() + _start, _used - _start);
+		_used -= _start;
+		_start = 0;
+	}
+	if (_in.size() - _used < CLIENT_RECV_CHUNK)
+		_in.resize(std::max(_in.size() * 2, _used + CLIENT_RECV_CHUNK));
+	while (true) {
+		ssize_t got = recv(_fd, _in.data() + _used, _in.size() - _used, 0);
+		if (got > 0) {
+			_used += got;
+			return;
+		}
+		if (got < 0 && errno == EINTR)
+			continue;
+		throw ClientExcClosed("The server closed the connection!");
+	}
+}
+
+ScheduleClient::ScheduleClient(const ClientOptions &options)
+{
+	if (!options.unix_path.empty()) {
+		sockaddr_un addr{};
+		if (options.unix_path.size() >= sizeof(addr.sun_path))
+			throw ClientExcConnect("The socket path is too long!");
+		addr.sun_family = AF_UNIX;
+		std::memcpy(addr.sun_path, options.unix_path.c_str(), options.unix_path.size() + 1);
+		_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (_fd < 0 || connect(_fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+			if (_fd >= 0)
+				close(_fd);
+			throw ClientExcConnect("Cannot connect to the server!");
+		}
+	} else {
+		addrinfo hints{}, *res;
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(options.host.c_str(), std::to_string(options.port).c_str(), &hints, &res) != 0)
+			throw ClientExcConnect("Cannot resolve the server address!");
+		_fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol);
+		if (_fd < 0 || connect(_fd, res->ai_addr, res->ai_addrlen) < 0) {
+			freeaddrinfo(res);
+			if (_fd >= 0)
+				close(_fd);
+			throw ClientExcConnect("Cannot connect to the server!");
+		}
+		freeaddrinfo(res);
+	}
+
+	if (options.shm) {
+		try {
+			_ring = ShmRing::negotiate(_fd);
+		} catch (const TransportExc &e) {
+			close(_fd);
+			throw ClientExcConnect("The server does not offer shared memory on this connection!");
+		}
+	}
+}
+
+ScheduleClient::~ScheduleClient()
+{
+	close(_fd); // сервер закроет сессию, как после stop
+}
+
+ScheduleReply ScheduleClient::query(std::string_view query)
+{
+	send(query);
+	return receive();
+}
+
+/*
+ * Запросы уходят окнами не больше CLIENT_PIPELINE_BYTES: сервер, отправляя длинный ответ, не читает
+ * запросы, и неограниченный конвейер мог бы заполнить буферы сокета в обе стороны.
+ */
+std::vector<ScheduleReply> ScheduleClient::batch(const std::vector<std::string> &queries)
+{
+	std::vector<ScheduleReply> replies;
+	replies.reserve(queries.size());
+	size_t sent = 0, in_flight = 0;
+	while (replies.size() < queries.size()) {
+		_out.clear();
+		while (sent < queries.size() &&
+			   (sent == replies.size() || in_flight + sizeof(int) + queries[sent].size() <= CLIENT_PIPELINE_BYTES)) {
+			put_frame(_out, queries[sent]);
+			in_flight += sizeof(int) + queries[sent].size();
+			++sent;
+		}
+		send_all(_out);
+		replies.push_back(receive());
+		in_flight -= sizeof(int) + queries[replies.size() - 1].size();
+	}
+	return replies;
+}
+
+void ScheduleClient::send(std::string_view query)
+{
+	_out.clear();
+	put_frame(_out, query);
+	send_all(_out);
+}
+
+ScheduleReply ScheduleClient::receive()
+{
+	std::string answer;
+	try {
+		if (_ring != nullptr && _ring->receive(answer)) {
+			long size = reply_size(answer);
+			if (size <= 0)
+				throw ClientExcProtocol("Broken answer in the shared memory!");
+			return ScheduleReply(std::move(answer), 0, size);
+		}
+	} catch (const TransportExc &e) {
+		throw ClientExcClosed(e.what());
+	}
+
+	long size;
+	while ((size = reply_size(std::string_view(_in.data() + _start, _used - _start))) == 0)
+		fill();
+	if (size < 0)
+		throw ClientExcProtocol("Unknown answer from the server!");
+	/* Большой ответ забирает буфер целиком, а остаток (начало следующих ответов) копируется. */
+	size_t begin = _start;
+	_start += size;
+	if (size_t(size) * 2 < _in.size())
+		return ScheduleReply(_in.substr(begin, size), 0, size);
+	std::string rest(_in.data() + _start, _used - _start);
+	std::string raw = std::move(_in);
+	_in = std::move(rest);
+	_used = _in.size();
+	_start = 0;
+	return ScheduleReply(std::move(raw), begin, size);
+}
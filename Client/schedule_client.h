@@ -0,0 +1,109 @@
+#ifndef SCHEDULE_CLIENT_H
+#define SCHEDULE_CLIENT_H
+
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ClientExc.h"
+#include "../Transport/protocol.h"
+
+#define CLIENT_RECV_CHUNK (64 * 1024)		// сколько места в буфере подставляется под recv
+#define CLIENT_PIPELINE_BYTES (64 * 1024)	// запросов без ответа не больше чем на столько байт
+
+class ShmRing;
+
+struct ClientOptions
+{
+	std::string host = "localhost";
+	int port = 5555;
+	std::string unix_path;	// подключаться через Unix-сокет сервера (server.PORT.sock) вместо TCP
+	bool shm = false;		// ... и получать ответы через общую память
+};
+
+/*
+ * Ответ сервера в том виде, в каком он пришёл. Строки print не копируются: итератор выдаёт
+ * string_view на буфер ответа, которые действительны, пока жив сам ответ.
+ */
+class ScheduleReply
+{
+  private:
+	std::string _raw;
+	size_t _begin;	// ответ может лежать не с начала буфера, из которого он был принят
+	int _code;
+	int _value = 0;	// число строк print или номер подготовленного запроса
+	size_t _body;	// позиция первой строки print или текста ошибки
+
+  public:
+	class RowIterator
+	{
+	  private:
+		const char *_pos = nullptr;
+
+	  public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::string_view;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const std::string_view*;
+		using reference = std::string_view;
+
+		RowIterator() = default;
+		explicit RowIterator(const char *pos) : _pos(pos) {}
+		std::string_view operator*() const;
+		RowIterator& operator++();
+		RowIterator operator++(int) { RowIterator old = *this; ++*this; return old; }
+		bool operator==(const RowIterator &other) const { return _pos == other._pos; }
+		bool operator!=(const RowIterator &other) const { return _pos != other._pos; }
+	};
+
+	/* raw с позиции begin содержит ответ целиком (см. reply_size). */
+	ScheduleReply(std::string raw, size_t begin, size_t size);
+
+	ProtocolCode code() const { return ProtocolCode(_code); }
+	bool ok() const { return _code != ERROR; }
+	/* Текст ошибки (пусто, если ответ не ERROR). */
+	std::string_view error() const;
+	/* Номер запроса, подготовленного командой prepare. */
+	int prepared() const { return _code == PREPARED ? _value : -1; }
+	/* Число строк print. */
+	size_t size() const { return _code == PRINT_DATA ? _value : 0; }
+	RowIterator begin() const;
+	RowIterator end() const;
+};
+
+/*
+ * Соединение с сервером. Сессия (выборка select, подготовленные запросы) живёт, пока открыто
+ * соединение. Запросы пакета отправляются конвейером: клиент не ждёт ответа на каждый запрос
+ * перед отправкой следующего, а сервер отвечает на них по порядку.
+ */
+class ScheduleClient
+{
+  private:
+	int _fd = -1;
+	std::unique_ptr<ShmRing> _ring;
+	std::string _in;		// принятое; непрочитанное лежит в [_start, _used)
+	size_t _start = 0;
+	size_t _used = 0;
+	std::string _out;
+
+	void send_all(std::string_view data);
+	/* Дочитывает из сокета хотя бы один байт. */
+	void fill();
+
+  public:
+	explicit ScheduleClient(const ClientOptions &options = ClientOptions());
+	ScheduleClient(const ScheduleClient &) = delete;
+	ScheduleClient& operator=(const ScheduleClient &) = delete;
+	~ScheduleClient();
+
+	ScheduleReply query(std::string_view query);
+	/* Ответы в том же порядке, что и запросы. */
+	std::vector<ScheduleReply> batch(const std::vector<std::string> &queries);
+
+	/* Отправить запрос и отдельно принять ответ (ответы приходят в порядке запросов). */
+	void send(std::string_view query);
+	ScheduleReply receive();
+};
+
+#endif // SCHEDULE_CLIENT_H
@@ -0,0 +1,82 @@
+#include "schedule_pool.h"
+
+/* -----------------------------------------PRIVATE METHODS-------------------------------------- */
+
+void SchedulePool::worker()
+{
+	std::unique_ptr<ScheduleClient> client;
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this] { return _stop || !_jobs.empty(); });
+			if (_jobs.empty())
+				return;
+			job = std::move(_jobs.front());
+			_jobs.pop_front();
+		}
+		std::vector<ScheduleReply> replies;
+		std::exception_ptr error;
+		try {
+			if (client == nullptr)
+				client = std::make_unique<ScheduleClient>(_options);
+			replies = client->batch(job.queries);
+		} catch (const ClientExc &e) {
+			client.reset(); // соединение в неизвестном состоянии
+			error = std::current_exception();
+		}
+		job.done(std::move(replies), error);
+	}
+}
+
+/* ----------------------------------------PUBLIC METHODS---------------------------------------- */
+
+SchedulePool::SchedulePool(const ClientOptions &options, size_t connections) : _options(options)
+{
+	for (size_t i = 0; i < connections; ++i)
+		_workers.emplace_back(&SchedulePool::worker, this);
+}
+
+SchedulePool::~SchedulePool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+	for (std::thread &t : _workers)
+		t.join();
+}
+
+void SchedulePool::async_batch(std::vector<std::string> queries, Callback done)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_jobs.push_back({std::move(queries), std::move(done)});
+	}
+	_wake.notify_one();
+}
+
+std::future<std::vector<ScheduleReply>> SchedulePool::async_batch(std::vector<std::string> queries)
+{
+	auto promise = std::make_shared<std::promise<std::vector<ScheduleReply>>>();
+	async_batch(std::move(queries), [promise](std::vector<ScheduleReply> &&replies, std::exception_ptr error) {
+		if (error)
+			promise->set_exception(error);
+		else
+			promise->set_value(std::move(replies));
+	});
+	return promise->get_future();
+}
+
+std::future<ScheduleReply> SchedulePool::async(std::string query)
+{
+	auto promise = std::make_shared<std::promise<ScheduleReply>>();
+	async_batch({std::move(query)}, [promise](std::vector<ScheduleReply> &&replies, std::exception_ptr error) {
+		if (error)
+			promise->set_exception(error);
+		else
+			promise->set_value(std::move(replies.front()));
+	});
+	return promise->get_future();
+}
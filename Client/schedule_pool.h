@@ -0,0 +1,54 @@
+#ifndef SCHEDULE_POOL_H
+#define SCHEDULE_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include "schedule_client.h"
+
+/*
+ * Пул соединений для асинхронных запросов. Каждое соединение обслуживает свой поток; задание -
+ * пакет запросов, который целиком, конвейером, исполняется на одном соединении, так что
+ * "select ...; print ..." в одном пакете видят одну и ту же выборку. Между заданиями сессия
+ * соединения сохраняется, но какое соединение достанется заданию, не определено, поэтому задание
+ * не должно полагаться на выборку, сделанную другим. Соединения открываются при первом задании и
+ * после ошибки открываются заново; само задание при ошибке не повторяется.
+ */
+class SchedulePool
+{
+  public:
+	/* Ответы либо исключение (тогда replies пуст). Вызывается в потоке пула и не должен бросать. */
+	using Callback = std::function<void(std::vector<ScheduleReply> &&replies, std::exception_ptr error)>;
+
+  private:
+	struct Job {
+	  std::vector<std::string> queries;
+	  Callback done;
+	};
+
+	ClientOptions _options;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::deque<Job> _jobs;
+	bool _stop = false;
+	std::vector<std::thread> _workers;
+
+	void worker();
+
+  public:
+	SchedulePool(const ClientOptions &options, size_t connections);
+	SchedulePool(const SchedulePool &) = delete;
+	SchedulePool& operator=(const SchedulePool &) = delete;
+	/* Дожидается заданий, уже поставленных в очередь. */
+	~SchedulePool();
+
+	void async_batch(std::vector<std::string> queries, Callback done);
+	std::future<std::vector<ScheduleReply>> async_batch(std::vector<std::string> queries);
+	std::future<ScheduleReply> async(std::string query);
+};
+
+#endif // SCHEDULE_POOL_H
@@ -1,192 +1,218 @@
+#include <cstdio>
+#include <cerrno>
+#include <charconv>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <ctime>
+#include <latch>
+#include <malloc.h>
 #include "database.h"
 
 
 /* -----------------------------------------PRIVATE METHODS-------------------------------------- */
 
 
-void Database::name_remove(NameSchedule &ns, const std::string &name, const SchedulePosition &pos)
+static uint64_t nanos_since(std::chrono::steady_clock::time_point started)
 {
-	auto it = ns.find(name);
-	auto &positions = it.val();
-	int n = positions.size();
-	for (int i = 0; i < n-1; ++i) {
-		if (positions[i] == pos) {
-			positions[i] = positions[n - 1];
-			break;
-		}
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+
+/* Путь доступа для шаблона, если его не изменят значения, подставленные на место "?". */
+std::optional<AccessPath> Database::choose_path(const PrepareQuery &query)
+{
+	for (const auto &cond : query.conditions()) {
+		if (cond.field != TEACHER && cond.field != SUBJECT)
+			continue;
+		if (query.is_param(cond.field) && query.command() != INSERT)
+			return std::nullopt; // вместо "?" может оказаться как имя, так и начало имени
+		if (cond.relation == EQUAL)
+			return cond.field == TEACHER ? TEACHER_INDEX : SUBJECT_INDEX;
 	}
-	positions.pop_back();
-	if (positions.empty())
-		ns.erase(name);
+	return FULL_SCAN;
 }
 
 
-Record Database::get_record(const SchedulePosition &pos) const
+bool Database::exists(const ConditionalQuery &query) const
 {
-	Record record;
-	const ScheduleItem &item = _schedule[pos.timecode][pos.room];
-	record.teacher = item.teacher;
-	record.subject = item.subject;
-	record.room = pos.room;
-	record.time = pos.timecode;
-	record.group = item.group;
-	return record;
+	bool found = false;
+	_data.scan(query, Storage::choose_path(query), [&found](const SchedulePosition &) {
+		found = true;
+		return false;
+	});
+	return found;
 }
 
 
-bool Database::match(const SchedulePosition &pos, const Condition &cond) const
+/* Поток дня не раздаёт работу потокам дней: он мог бы ждать сам себя. */
+static thread_local bool On_Day_Thread = false;
+/* Фоновый поток тоже: его блоки заняли бы потоки дней, и изменения ждали бы печать на снимке. */
+static thread_local bool On_Reader_Thread = false;
+
+
+bool Database::can_parallel() const
 {
-	const ScheduleItem &item = _schedule[pos.timecode][pos.room];
-	if (cond.field == TEACHER || cond.field == SUBJECT) {
-		const auto &name = std::get<std::string>(cond.value);
-		const std::string &candidate = (cond.field == TEACHER ? item.teacher : item.subject);
-		if (cond.relation == EQUAL)
-			return candidate == name;
-		return candidate.starts_with(name);
-	}
-
-	int candidate;
-	if (cond.field == ROOM)
-		candidate = pos.room;
-	else if (cond.field == DAY)
-		candidate = Time(pos.timecode).day;
-	else if (cond.field == PERIOD)
-		candidate = Time(pos.timecode).period;
-	else if (cond.field == GROUP)
-		candidate = item.group;
-	
-	if (cond.relation == EQUAL)
-		return candidate == std::get<int>(cond.value);
-	const auto &range = std::get<std::pair<int, int>>(cond.value);
-	return candidate >= range.first && candidate <= range.second;
+	return _partitions[0] != nullptr && !On_Day_Thread && !On_Reader_Thread;
 }
 
 
-bool Database::match(const SchedulePosition &pos, const ConditionalQuery &query) const
+template <class Task>
+void Database::parallel(size_t n, Task task) const
 {
-	if (_schedule[pos.timecode][pos.room].empty())
-		return false;
-	for (const auto &cond : query.conditions())
-		if (!match(pos, cond))
-			return false;
-	return true;
+	std::latch done(n);
+	for (size_t i = 0; i < n; ++i)
+		_partitions[i % NUM_OF_DAYS]->submit([&task, &done, i] {
+			On_Day_Thread = true;
+			task(i);
+			done.count_down();
+		});
+	done.wait();
 }
 
 
-std::vector<SchedulePosition> Database::find(const ConditionalQuery &query) const
+/*
+ * Большой перебор ячеек делится на блоки соседних timecode, а поиск по индексу - на дни (внутри дня
+ * списки индекса идут не по порядку timecode). Блоки перебирают потоки дней, и найденное
+ * склеивается по порядку блоков - так же, как нашёл бы один поток.
+ */
+Database::Positions Database::find(const Storage &data, const ConditionalQuery &query, AccessPath path,
+								   std::pmr::memory_resource *mr, Plan &plan) const
 {
-	std::vector<SchedulePosition> ans;
-	std::pair<int, int> room = {0, NUM_OF_ROOMS}, day = {1, NUM_OF_DAYS}, period = {1, NUM_OF_PERIODS};
-	for (const auto &cond : query.conditions())
-	{
-		if (cond.field == TEACHER && cond.relation == EQUAL) {
-			const auto &teacher = std::get<std::string>(cond.value);
-			if (_teachers.find(teacher) != _teachers.cend())
-				for (const SchedulePosition &pos : _teachers[teacher])
-					if (match(pos, query))
-						ans.push_back(pos);
-			return ans;
-		}
-		if (cond.field == SUBJECT && cond.relation == EQUAL) {
-			const auto &subject = std::get<std::string>(cond.value);
-			if (_subjects.find(subject) != _subjects.cend())
-				for (const SchedulePosition &pos : _subjects[subject])
-					if (match(pos, query))
-						ans.push_back(pos);
-			return ans;
-		}
-		
-		if (cond.field == ROOM) {
-			room = cond.get_range();
-		} else if (cond.field == DAY) {
-			day = cond.get_range();
-		} else if (cond.field == PERIOD) {
-			period = cond.get_range();
-		}
-	}
-	for (int d = day.first; d <= day.second; ++d) {
-		for (int p = period.first; p <= period.second; ++p) {
-			for (int r = room.first; r <= room.second; ++r) {
-				SchedulePosition pos({d, p}, r);
-				if (match(pos, query))
-					ans.push_back(pos);
-			}
+	TRACE_SPAN("Database::find");
+	auto started = std::chrono::steady_clock::now();
+	Positions ans(mr);
+	plan.done = true;
+	plan.path = path;
+	plan.estimated = data.estimate(query, path);
+	std::pair<int, int> days = Storage::days(query);
+	if (!can_parallel() || days.first > days.second || plan.estimated < PARALLEL_SCAN_CELLS) {
+		plan.visited = data.scan(query, path, [&ans](const SchedulePosition &pos) {
+			ans.push_back(pos);
+			return true;
+		});
+	} else {
+		int first = Time(days.first, 1), times = (days.second - days.first + 1) * NUM_OF_PERIODS;
+		size_t blocks = (path == FULL_SCAN ? std::min(times, 2 * NUM_OF_DAYS) : days.second - days.first + 1);
+		std::vector< std::vector<PackedPosition> > found(blocks);
+		std::vector<size_t> visited(blocks);
+		parallel(blocks, [&](size_t b) {
+			TRACE_SPAN("find: block");
+			std::pair<int, int> block = {first + times * b / blocks, first + times * (b + 1) / blocks - 1};
+			visited[b] = data.scan(query, path, [&found, b](const SchedulePosition &pos) {
+				found[b].push_back(pos);
+				return true;
+			}, block);
+		});
+		size_t total = 0;
+		for (const auto &part : found)
+			total += part.size();
+		ans.reserve(total);
+		for (size_t b = 0; b < blocks; ++b) {
+			ans.insert(ans.end(), found[b].begin(), found[b].end());
+			plan.visited += visited[b];
 		}
+		plan.blocks = blocks;
+		Metrics::local().lookups[path].add();
 	}
+	plan.matches = ans.size();
+	plan.find_ns = nanos_since(started);
 	return ans;
 }
 
 
-QueryResult Database::insert(const UserId &user, const Query *query)
+QueryResult Database::insert(const UserId &user, const InsertQuery &query)
 {
-	auto q = dynamic_cast<const InsertQuery*>(query);
-	assert(q != nullptr && "Bad cast in insert");
-
 	QueryResult result;
 	result.set_servcode(SEND_INFO);
-	const auto &conds = q->conditions();
+	const auto &conds = query.conditions();
 
 	std::vector<Condition> conflict = {conds[DAY], conds[PERIOD], conds[ROOM]};
-	if (!find(conflict).empty()) {
+	if (exists(conflict)) {
 		result.set_protcode(ERROR);
 		result.set_info("The room is occupied at this time!");
 		return result;
 	}
 	conflict.back() = conds[TEACHER];
-	if (!find(conflict).empty()) {
+	if (exists(conflict)) {
 		result.set_protcode(ERROR);
 		result.set_info("The teacher is busy at this time!");
 		return result;
 	}
 	conflict.back() = conds[GROUP];
-	if (!find(conflict).empty()) {
+	if (exists(conflict)) {
 		result.set_protcode(ERROR);
 		result.set_info("The group is busy at this time!");
 		return result;
 	}
 
-	Time time(std::get<int>(conds[DAY].value), std::get<int>(conds[PERIOD].value));
-	int room = std::get<int>(conds[ROOM].value);
-	const auto& teacher = std::get<std::string>(conds[TEACHER].value);
-	const auto& subject = std::get<std::string>(conds[SUBJECT].value);
-	_schedule[time][room].used = true;
-	_schedule[time][room].group = std::get<int>(conds[GROUP].value);
-	_schedule[time][room].teacher = teacher;
-	_schedule[time][room].subject = subject;
-	_teachers[teacher].push_back({time, room});
-	_subjects[subject].push_back({time, room});
+	Record record;
+	record.teacher = std::get<std::string>(conds[TEACHER].value);
+	record.subject = std::get<std::string>(conds[SUBJECT].value);
+	record.room = std::get<int>(conds[ROOM].value);
+	record.time = Time(std::get<int>(conds[DAY].value), std::get<int>(conds[PERIOD].value));
+	record.group = std::get<int>(conds[GROUP].value);
+	_data.put({record.time, record.room}, record);
+	if (_journal != nullptr)
+		_day_logs[record.time.day - 1].log_insert(record);
 
-	_sessions[user].last_query = INSERT;
+	_sessions.at(user).last_query = INSERT;
 	result.set_protcode(SUCCESS);
 	return result;
 }
 
 
-QueryResult Database::remove(const UserId &user, const Query *query)
+QueryResult Database::remove(const UserId &user, const RemoveQuery &query)
+{
+	return remove_by(user, query, Storage::choose_path(query));
+}
+
+
+QueryResult Database::remove_by(const UserId &user, const ConditionalQuery &query, AccessPath path)
 {
-	auto q = dynamic_cast<const RemoveQuery*>(query);
-	assert(q != nullptr && "Bad cast in remove");
 	QueryResult result;
-	std::vector<SchedulePosition> to_remove = find(*q);
-	for (const auto &pos : to_remove) {
-		ScheduleItem &item = _schedule[pos.timecode][pos.room];
-		name_remove(_teachers, item.teacher, pos);
-		name_remove(_subjects, item.subject, pos);
-		item.clear();
-	}
-	_sessions[user].last_query = REMOVE;
+	Session &session = _sessions.at(user);
+	Positions to_remove = find(_data, query, path, &session.arena, session.plan);
+	auto [first, last] = Storage::days(query);
+	size_t records = 0;	// записей в днях, которых касается запрос (другие дни может менять их поток)
+	for (int d = first; d <= last; ++d)
+		records += _data.day(d).records;
+
+	if (_journal != nullptr) {
+		if (first == 1 && last == NUM_OF_DAYS && to_remove.size() == records && records > 0) {
+			flush_logs();
+			_journal->log_truncate();
+		} else {
+			for (SchedulePosition pos : to_remove)
+				_day_logs[Time(pos.timecode).day - 1].log_remove(_data.cell(pos), pos);
+		}
+	}
+	if (to_remove.size() * BULK_REMOVE_SHARE >= records) {
+		_data.erase_all(to_remove);
+	} else {
+		for (SchedulePosition pos : to_remove)
+			_data.erase(pos);
+	}
+	session.last_query = REMOVE;
 	result.set_protcode(SUCCESS);
 	result.set_servcode(SEND_INFO);
 	return result;
 }
 
 
-QueryResult Database::select(const UserId &user, const Query *query)
+QueryResult Database::select(const UserId &user, const SelectQuery &query)
+{
+	return select_by(user, query, std::nullopt);
+}
+
+
+QueryResult Database::select_by(const UserId &user, const SelectQuery &query, std::optional<AccessPath> path)
 {
-	auto q = dynamic_cast<const SelectQuery *>(query);
-	assert(q != nullptr && "Bad cast in select");
 	QueryResult result;
-	_sessions[user].select_query = *q;
+	_sessions[user].select_query = query;
+	_sessions[user].select_path = path;
 	_sessions[user].last_query = SELECT;
 	result.set_protcode(SUCCESS);
 	result.set_servcode(SEND_INFO);
@@ -194,11 +220,8 @@ QueryResult Database::select(const UserId &user, const Query *query)
 }
 
 
-QueryResult Database::reselect(const UserId &user, const Query *query)
+QueryResult Database::reselect(const UserId &user, const ReselectQuery &query)
 {
-	auto q = dynamic_cast<const ReselectQuery *>(query);
-	assert(q != nullptr && "Bad cast in reselect");
-	
 	QueryResult result;
 	result.set_servcode(SEND_INFO);
 
@@ -209,18 +232,105 @@ QueryResult Database::reselect(const UserId &user, const Query *query)
 		return result;
 	}
 
-	_sessions[user].select_query *= (*q);
+	_sessions[user].select_query *= query;
+	_sessions[user].select_path.reset();
 	_sessions[user].last_query = RESELECT;
 	result.set_protcode(SUCCESS);
 	return result;
 }
 
 
-QueryResult Database::print(const UserId &user, const Query *query)
+/*
+ * Сортируются позиции, а не записи. Большой массив сортируется кусками в потоках дней, после чего
+ * куски попарно сливаются, тоже параллельно; сортировка кусков и слияние устойчивы.
+ */
+void Database::sort_positions(const Storage &data, Positions &positions, const PrintQuery &query, Plan &plan) const
 {
-	auto q = dynamic_cast<const PrintQuery *>(query);
-	assert(q != nullptr && "Bad cast in print");
+	if (query.sortby().empty())
+		return;
+	TRACE_SPAN("print: sort");
+	auto started = std::chrono::steady_clock::now();
+	auto less = [&data, &query](const SchedulePosition &p1, const SchedulePosition &p2) {
+		return data.less(p1, p2, query.sortby());
+	};
+	if (positions.size() < PARALLEL_PRINT_ROWS || !can_parallel()) {
+		std::sort(positions.begin(), positions.end(), less);
+	} else {
+		const size_t chunks = NUM_OF_DAYS;
+		auto bound = [&positions, chunks](size_t i) { return positions.begin() + positions.size() * i / chunks; };
+		parallel(chunks, [&](size_t i) {
+			std::stable_sort(bound(i), bound(i + 1), less);
+		});
+		for (size_t width = 1; width < chunks; width *= 2)
+			parallel((chunks + 2 * width - 1) / (2 * width), [&](size_t m) {
+				size_t lo = 2 * width * m, mid = std::min(lo + width, chunks), hi = std::min(lo + 2 * width, chunks);
+				std::inplace_merge(bound(lo), bound(mid), bound(hi), less);
+			});
+	}
+	plan.sort_ns = nanos_since(started);
+}
+
 
+/*
+ * Арена сессии не рассчитана на несколько потоков, поэтому при параллельном форматировании строки
+ * заранее получают ёмкость с запасом, и потоки дней только дописывают в них без выделения памяти.
+ */
+QueryResult::Rows Database::format_rows(const Storage &data, const Positions &positions, const PrintQuery &query,
+										std::pmr::memory_resource *mr, Plan &plan) const
+{
+	TRACE_SPAN("print: format");
+	auto started = std::chrono::steady_clock::now();
+	QueryResult::Rows ans(mr);
+	if (positions.size() < PARALLEL_PRINT_ROWS || !can_parallel()) {
+		ans.reserve(positions.size());
+		for (SchedulePosition pos : positions) {
+			std::pmr::string &row = ans.emplace_back();
+			for (Field field : query.fields())
+				data.append_field(row, pos, field);
+		}
+	} else {
+		ans.resize(positions.size());
+		for (size_t i = 0; i < positions.size(); ++i) {
+			size_t width = 0;
+			for (Field field : query.fields())
+				width += data.field_width(positions[i], field);
+			ans[i].reserve(width);
+		}
+		const size_t chunks = 2 * NUM_OF_DAYS;
+		parallel(chunks, [&](size_t c) {
+			for (size_t i = positions.size() * c / chunks; i < positions.size() * (c + 1) / chunks; ++i)
+				for (Field field : query.fields())
+					data.append_field(ans[i], positions[i], field);
+		});
+	}
+	plan.format_ns = nanos_since(started);
+	return ans;
+}
+
+
+QueryResult Database::print_rows(const Storage &data, const SelectQuery &select_query, AccessPath path,
+								 const PrintQuery &query, std::pmr::memory_resource *mr, Plan &plan) const
+{
+	QueryResult result;
+	Positions positions = find(data, select_query, path, mr, plan);
+	sort_positions(data, positions, query, plan);
+	QueryResult::Rows ans = format_rows(data, positions, query, mr, plan);
+	plan.printed = true;
+	Metrics::local().rows_returned.add(ans.size());
+	result.set_protcode(PRINT_DATA);
+	result.set_servcode(SEND_INFO);
+	result.set_info(std::move(ans));
+	return result;
+}
+
+
+/*
+ * Если print предстоит долгий, а фоновые потоки есть, он исполняется на снимке базы: писатели
+ * тем временем продолжают работу, а print видит базу такой, какой она была в момент запроса.
+ * Снимков не больше MAX_SNAPSHOTS, поэтому и старых версий каждой страницы не больше стольких же.
+ */
+QueryResult Database::print(const UserId &user, const PrintQuery &query)
+{
 	QueryResult result;
 	result.set_servcode(SEND_INFO);
 
@@ -231,66 +341,192 @@ QueryResult Database::print(const UserId &user, const Query *query)
 		return result;
 	}
 	
-	const SelectQuery &select_query = (_sessions.find(user)->second).select_query;
-	std::vector<SchedulePosition> positions = find(select_query);
-	std::vector<Record> records;
-	for (const auto &pos : positions)
-		records.push_back(get_record(pos));
-
-	std::sort(records.begin(), records.end(), [q](const Record &r1, const Record &r2) {
-		for (Field field : q->sortby()) {
-			if (field == TEACHER) {
-				if (r1.teacher != r2.teacher)
-					return r1.teacher < r2.teacher;
-			} else if (field == SUBJECT) {
-				if (r1.subject != r2.subject)
-					return r1.subject < r2.subject;
-			} else if (field == ROOM) {
-				if (r1.room != r2.room)
-					return r1.room < r2.room;
-			} else if (field == DAY) {
-				if (r1.time.day != r2.time.day)
-					return r1.time.day < r2.time.day;
-			} else if (field == PERIOD) {
-				if (r1.time.period != r2.time.period)
-					return r1.time.period < r2.time.period;
-			} else if (field == GROUP) {
-				if (r1.group != r2.group)
-					return r1.group < r2.group;
+	Session &session = _sessions.find(user)->second;
+	const SelectQuery &select_query = session.select_query;
+	AccessPath path = session.select_path ? *session.select_path : Storage::choose_path(select_query);
+	session.last_query = PRINT;
+	if (_readers == nullptr || _jobs >= MAX_SNAPSHOTS ||
+		_data.estimate(select_query, path) < SNAPSHOT_PRINT_CELLS)
+		return print_rows(_data, select_query, path, query, &session.arena, session.plan);
+
+	_deferred.reset(new PrintJob{user, _data, select_query, path, query, &session.arena, {}, {}, {}, {}});
+	result.set_servcode(ANSWER_LATER);
+	return result;
+}
+
+
+QueryResult Database::aggregate(const UserId &user, const AggregateQuery &query)
+{
+	TRACE_SPAN("Database::aggregate");
+	QueryResult result;
+	Session &session = _sessions[user];
+	QueryResult::Rows ans(&session.arena);
+	const auto &conds = query.conditions();
+	const auto &groupby = query.groupby();
+
+	auto is_index_field = [](Field field) { return field == TEACHER || field == SUBJECT; };
+	if (query.count_only() && groupby.empty() && conds.empty()) {
+		append_int(ans.emplace_back(), _data.records());
+		ans.back() += "; ";
+	} else if (query.count_only() && groupby.empty() && conds.size() == 1 &&
+			   is_index_field(conds[0].field) && conds[0].relation == EQUAL) {
+		append_int(ans.emplace_back(), _data.estimate(query, Storage::choose_path(query)));
+		ans.back() += "; ";
+	} else if (query.count_only() && groupby.size() == 1 && conds.empty() && is_index_field(groupby[0])) {
+		/* Индексы свои у каждого дня: длины списков одного имени складываются. */
+		std::pmr::vector< std::pair<std::string_view, size_t> > lists(&session.arena);
+		for (int d = 1; d <= NUM_OF_DAYS; ++d) {
+			const DayPage &page = _data.day(d);
+			(groupby[0] == TEACHER ? page.teachers : page.subjects).for_each(
+				[&lists](const auto &name, const auto &positions) { lists.emplace_back(name, positions.size()); });
+		}
+		std::sort(lists.begin(), lists.end());
+		for (size_t i = 0; i < lists.size(); /* void */) {
+			size_t count = 0, j = i;
+			for (; j < lists.size() && lists[j].first == lists[i].first; ++j)
+				count += lists[j].second;
+			std::pmr::string &row = ans.emplace_back();
+			row += lists[i].first;
+			row += "; ";
+			append_int(row, count);
+			row += "; ";
+			i = j;
+		}
+	} else {
+		struct Group {
+			SchedulePosition sample;	// любая запись группы: по ней печатаются и сравниваются поля группировки
+			size_t count = 0;
+			int min[NUM_OF_FIELDS], max[NUM_OF_FIELDS];
+		};
+		const auto &aggregates = query.aggregates();
+		std::pmr::unordered_map<std::pmr::string, Group> groups(&session.arena);
+		std::pmr::string key(&session.arena);
+		_data.scan(query, Storage::choose_path(query), [&](const SchedulePosition &pos) {
+			key.clear();
+			for (Field field : groupby)
+				_data.append_field(key, pos, field);
+			auto [it, inserted] = groups.try_emplace(key);
+			Group &group = it->second;
+			for (const Aggregate &agg : aggregates) {
+				if (agg.function == AGG_COUNT)
+					continue;
+				int value = _data.numeric(pos, agg.field);
+				if (inserted || value < group.min[agg.field])
+					group.min[agg.field] = value;
+				if (inserted || value > group.max[agg.field])
+					group.max[agg.field] = value;
 			}
+			if (inserted)
+				group.sample = pos;
+			++group.count;
+			return true;
+		});
+
+		std::pmr::vector<const std::pair<const std::pmr::string, Group> *> sorted(&session.arena);
+		sorted.reserve(groups.size());
+		for (const auto &entry : groups)
+			sorted.push_back(&entry);
+		std::sort(sorted.begin(), sorted.end(), [this, &groupby](const auto *g1, const auto *g2) {
+			return _data.less(g1->second.sample, g2->second.sample, groupby);
+		});
+		/* Без группировки ответ есть всегда, даже если ничего не нашлось: count равен 0, min и max пусты. */
+		if (sorted.empty() && groupby.empty()) {
+			std::pmr::string &row = ans.emplace_back();
+			for (const Aggregate &agg : aggregates)
+				row += (agg.function == AGG_COUNT ? "0; " : "; ");
 		}
-		return false;
-	});
+		for (const auto *entry : sorted) {
+			std::pmr::string &row = ans.emplace_back(entry->first);
+			const Group &group = entry->second;
+			for (const Aggregate &agg : aggregates) {
+				if (agg.function == AGG_COUNT)
+					append_int(row, group.count);
+				else
+					append_int(row, agg.function == AGG_MIN ? group.min[agg.field] : group.max[agg.field]);
+				row += "; ";
+			}
+		}
+	}
+
+	Metrics::local().rows_returned.add(ans.size());
+	session.last_query = query.type();
+	result.set_protcode(PRINT_DATA);
+	result.set_servcode(SEND_INFO);
+	result.set_info(std::move(ans));
+	return result;
+}
+
+
+/*
+ * Ячейка свободна, если пуста сама, а преподаватель и группа не заняты в это время. Занятость
+ * преподавателя берётся из его списка в индексе, занятость группы - одним проходом по нужным дням и
+ * парам; после этого ячейки проверяются по порядку (день, пара, аудитория) до limit найденных.
+ */
+QueryResult Database::free_slots(const UserId &user, const FreeQuery &query)
+{
+	TRACE_SPAN("Database::free_slots");
+	QueryResult result;
+	Session &session = _sessions[user];
+	QueryResult::Rows ans(&session.arena);
 
-	std::vector<std::string> ans;
-	for (const Record &rec : records) {
-		ans.push_back("");
-		for (Field field : q->fields()) {
-			if (field == TEACHER)
-				ans.back() += rec.teacher;
-			else if (field == SUBJECT)
-				ans.back() += rec.subject;
-			else if (field == ROOM)
-				ans.back() += std::to_string(rec.room);
-			else if (field == DAY)
-				ans.back() += std::to_string(rec.time.day);
-			else if (field == PERIOD)
-				ans.back() += std::to_string(rec.time.period);
-			else if (field == GROUP)
-				ans.back() += std::to_string(rec.group);
-			ans.back() += "; ";
+	std::pair<int, int> room = {0, NUM_OF_ROOMS}, day = {1, NUM_OF_DAYS}, period = {1, NUM_OF_PERIODS};
+	bool busy[NUM_OF_PERIODS * NUM_OF_DAYS] = {};
+	std::vector<Condition> group_conds;	// когда группа занята в заданные дни и пары
+	for (const auto &cond : query.conditions()) {
+		if (cond.field == TEACHER) {
+			for (int d = 1; d <= NUM_OF_DAYS; ++d) {
+				const DayPage::NameSchedule &teachers = _data.day(d).teachers;
+				auto it = teachers.find(std::get<std::string>(cond.value));
+				if (it != teachers.cend())
+					for (SchedulePosition pos : it.val())
+						busy[pos.timecode] = true;
+			}
+		} else if (cond.field == ROOM) {
+			room = cond.get_range();
+		} else {
+			if (cond.field == DAY)
+				day = cond.get_range();
+			else if (cond.field == PERIOD)
+				period = cond.get_range();
+			group_conds.push_back(cond);
 		}
 	}
-	_sessions[user].last_query = PRINT;
+	if (!group_conds.empty() && group_conds.back().field == GROUP)
+		_data.scan(group_conds, FULL_SCAN, [&busy](const SchedulePosition &pos) {
+			busy[pos.timecode] = true;
+			return true;
+		});
+
+	size_t limit = query.limit() ? query.limit() : SIZE_MAX;
+	for (int d = day.first; d <= day.second && ans.size() < limit; ++d) {
+		for (int p = period.first; p <= period.second && ans.size() < limit; ++p) {
+			if (busy[Time(d, p)])
+				continue;
+			for (int r = room.first; r <= room.second && ans.size() < limit; ++r) {
+				if (!_data.cell(SchedulePosition({d, p}, r)).empty())
+					continue;
+				std::pmr::string &row = ans.emplace_back();
+				append_int(row, d);
+				row += "; ";
+				append_int(row, p);
+				row += "; ";
+				append_int(row, r);
+				row += "; ";
+			}
+		}
+	}
+
+	Metrics::local().rows_returned.add(ans.size());
+	session.last_query = FREE;
 	result.set_protcode(PRINT_DATA);
-	result.set_info(ans);
+	result.set_servcode(SEND_INFO);
+	result.set_info(std::move(ans));
 	return result;
 }
 
 
-QueryResult Database::shutdown(const UserId &user, const Query *query)
+QueryResult Database::shutdown(const UserId &user)
 {
-	assert((query == nullptr || query->type() == SHUTDOWN) && "Incorrect call of \'remove_all_users\'");
 	QueryResult result;
 	result.set_protcode(QUIT);
 	result.set_servcode(SERVER_SHUTDOWN);
@@ -299,23 +535,461 @@ QueryResult Database::shutdown(const UserId &user, const Query *query)
 }
 
 
-const Database::Scripts& Database::scripts()
+/* В журнал попадает одна запись вместо записи на каждую удалённую ячейку. */
+QueryResult Database::truncate(const UserId &user)
+{
+	QueryResult result;
+	if (_journal != nullptr) {
+		flush_logs();
+		_journal->log_truncate();
+	}
+	_data.truncate();
+	_sessions.at(user).last_query = TRUNCATE;
+	result.set_protcode(SUCCESS);
+	result.set_servcode(SEND_INFO);
+	return result;
+}
+
+
+QueryResult Database::stats(const UserId &user)
+{
+	QueryResult result;
+	Session &session = _sessions[user];
+	QueryResult::Rows ans(&session.arena);
+	for (const std::string &line : stats_report())
+		ans.emplace_back(line);
+	session.last_query = STATS;
+	result.set_protcode(PRINT_DATA);
+	result.set_servcode(SEND_INFO);
+	result.set_info(std::move(ans));
+	return result;
+}
+
+
+QueryResult Database::memory(const UserId &user)
+{
+	QueryResult result;
+	Session &session = _sessions[user];
+	QueryResult::Rows ans(&session.arena);
+	for (const std::string &line : memory_report())
+		ans.emplace_back(line);
+	session.last_query = MEMORY;
+	result.set_protcode(PRINT_DATA);
+	result.set_servcode(SEND_INFO);
+	result.set_info(std::move(ans));
+	return result;
+}
+
+
+/*
+ * Данные не меняются, поэтому в журнал ничего не пишется. Буферы сессий не трогаются: в них
+ * могут лежать ещё не отправленные ответы, а освобождаются они и так перед следующим запросом.
+ * Освобождённое возвращается системе: malloc_trim отдаёт и пустые страницы посреди куч.
+ */
+QueryResult Database::compact(const UserId &user)
+{
+	QueryResult result;
+	_data.compact();
+	for (auto &[id, session] : _sessions)
+		session.prepared.shrink_to_fit();
+	malloc_trim(0);
+	_sessions.at(user).last_query = COMPACT;
+	result.set_protcode(SUCCESS);
+	result.set_servcode(SEND_INFO);
+	return result;
+}
+
+
+size_t Database::session_memory(const Session &session)
+{
+	size_t bytes = sizeof(session) + ARENA_SIZE + session.prepared.capacity() * sizeof(Prepared);
+	bytes += session.select_query.conditions().capacity() * sizeof(Condition);
+	for (const Prepared &stmt : session.prepared)
+		bytes += stmt.query.conditions().capacity() * sizeof(Condition);
+	return bytes;
+}
+
+
+QueryResult Database::explain(const UserId &user, const ExplainQuery &query)
+{
+	QueryResult result;
+	result.set_servcode(SEND_INFO);
+	Session &session = _sessions[user];
+
+	if (const PrintQuery *print_query = std::get_if<PrintQuery>(&query.query())) {
+		QueryType last = session.last_query;
+		if (last != SELECT && last != RESELECT && last != PRINT) {
+			result.set_protcode(ERROR);
+			result.set_info("Your last query should be \"select\", \"reselect\" or \"print\"!");
+			return result;
+		}
+		const SelectQuery &select_query = session.select_query;
+		Positions positions = find(_data, select_query,
+			session.select_path ? *session.select_path : Storage::choose_path(select_query), &session.arena, session.plan);
+		sort_positions(_data, positions, *print_query, session.plan);
+		format_rows(_data, positions, *print_query, &session.arena, session.plan);
+		session.plan.printed = true;
+	} else if (const SelectQuery *select_query = std::get_if<SelectQuery>(&query.query())) {
+		find(_data, *select_query, Storage::choose_path(*select_query), &session.arena, session.plan);
+	} else {
+		const RemoveQuery &remove_query = std::get<RemoveQuery>(query.query());
+		find(_data, remove_query, Storage::choose_path(remove_query), &session.arena, session.plan);
+	}
+
+	QueryResult::Rows ans(&session.arena);
+	for (const std::string &line : plan_report(session.plan))
+		ans.emplace_back(line);
+	result.set_protcode(PRINT_DATA);
+	result.set_info(std::move(ans));
+	return result;
+}
+
+
+QueryResult Database::trace(const UserId &user)
+{
+	QueryResult result;
+	result.set_servcode(SEND_INFO);
+	if (!Trace::enabled()) {
+		result.set_protcode(ERROR);
+		result.set_info("Tracing is disabled in this build!");
+		return result;
+	}
+	size_t events = Trace::dump(TRACE_FILE);
+	if (events == 0) {
+		result.set_protcode(ERROR);
+		result.set_info("No trace events were written!");
+		return result;
+	}
+	Session &session = _sessions[user];
+	QueryResult::Rows ans(&session.arena);
+	std::pmr::string &row = ans.emplace_back("Trace events written to " TRACE_FILE ": ");
+	append_int(row, events);
+	result.set_protcode(PRINT_DATA);
+	result.set_info(std::move(ans));
+	return result;
+}
+
+
+std::vector<std::string> Database::plan_report(const Plan &plan)
+{
+	static const char *Path_Names[] = {"teacher index", "subject index", "scan"};
+	std::vector<std::string> lines;
+	if (!plan.done)
+		return lines;
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1);
+	auto flush = [&lines, &out]() {
+		lines.push_back(out.str());
+		out.str("");
+	};
+	out << "access path: " << Path_Names[plan.path]; flush();
+	out << "estimated cells: " << plan.estimated; flush();
+	out << "visited cells: " << plan.visited; flush();
+	out << "matches: " << plan.matches; flush();
+	if (plan.snapshot) {
+		out << "executed on a snapshot"; flush();
+	}
+	if (plan.blocks > 0) {
+		out << "parallel blocks: " << plan.blocks; flush();
+	}
+	out << "find: " << plan.find_ns / 1000.0 << " us"; flush();
+	if (plan.printed) {
+		out << "sort: " << plan.sort_ns / 1000.0 << " us"; flush();
+		out << "format: " << plan.format_ns / 1000.0 << " us"; flush();
+	}
+	return lines;
+}
+
+
+void Database::log_slow(const UserId &user, std::string_view query, uint64_t ns, const Plan &plan)
+{
+	std::time_t now = std::time(nullptr);
+	char stamp[32];
+	std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+	_slow_log << stamp << " user " << user << ", " << std::fixed << std::setprecision(1) << ns / 1000.0
+			  << " us: " << query;
+	for (const std::string &line : plan_report(plan))
+		_slow_log << " | " << line;
+	_slow_log << std::endl;
+}
+
+
+QueryResult Database::prepare(const UserId &user, const PrepareQuery &query)
+{
+	QueryResult result;
+	std::vector<Prepared> &prepared = _sessions[user].prepared;
+	prepared.push_back({query, choose_path(query)});
+	_sessions[user].last_query = PREPARE;
+	result.set_protcode(PREPARED);
+	result.set_servcode(SEND_INFO);
+	result.set_info(int(prepared.size() - 1));
+	return result;
+}
+
+
+QueryResult Database::execute(const UserId &user, const ExecuteQuery &query)
+{
+	QueryResult result;
+	result.set_servcode(SEND_INFO);
+
+	const std::vector<Prepared> &prepared = _sessions.at(user).prepared;
+	if (size_t(query.handle()) >= prepared.size()) {
+		result.set_protcode(ERROR);
+		result.set_info("No such prepared query!");
+		return result;
+	}
+	const Prepared &stmt = prepared[query.handle()];
+	std::vector<Condition> conds;
+	try {
+		Lexer values(query.values());
+		conds = stmt.query.bind(values);
+	} catch (const QueryExc &e) {
+		result.set_protcode(ERROR);
+		result.set_info(e.what());
+		return result;
+	}
+
+	switch (stmt.query.command()) {
+	case INSERT:
+		return insert(user, InsertQuery(conds));
+	case REMOVE: {
+		RemoveQuery remove_query(conds);
+		return remove_by(user, remove_query, stmt.path ? *stmt.path : Storage::choose_path(remove_query));
+	}
+	case SELECT:
+		return select_by(user, SelectQuery(conds), stmt.path);
+	case RESELECT:
+		return reselect(user, ReselectQuery(conds));
+	default:
+		assert(false && "Unexpected prepared command");
+		return result;
+	}
+}
+
+
+struct Database::Dispatcher
+{
+	Database &db;
+	const UserId &user;
+
+	QueryResult operator()(const StopQuery &) const { return db.remove_user(user); }
+	QueryResult operator()(const ShutdownQuery &) const { return db.shutdown(user); }
+	QueryResult operator()(const InsertQuery &q) const { return db.insert(user, q); }
+	QueryResult operator()(const RemoveQuery &q) const { return db.remove(user, q); }
+	QueryResult operator()(const SelectQuery &q) const { return db.select(user, q); }
+	QueryResult operator()(const ReselectQuery &q) const { return db.reselect(user, q); }
+	QueryResult operator()(const PrintQuery &q) const { return db.print(user, q); }
+	QueryResult operator()(const PrepareQuery &q) const { return db.prepare(user, q); }
+	QueryResult operator()(const ExecuteQuery &q) const { return db.execute(user, q); }
+	QueryResult operator()(const StatsQuery &) const { return db.stats(user); }
+	QueryResult operator()(const ExplainQuery &q) const { return db.explain(user, q); }
+	QueryResult operator()(const TraceQuery &) const { return db.trace(user); }
+	QueryResult operator()(const AggregateQuery &q) const { return db.aggregate(user, q); }
+	QueryResult operator()(const FreeQuery &q) const { return db.free_slots(user, q); }
+	QueryResult operator()(const TruncateQuery &) const { return db.truncate(user); }
+	QueryResult operator()(const MemoryQuery &) const { return db.memory(user); }
+	QueryResult operator()(const CompactQuery &) const { return db.compact(user); }
+};
+
+
+void Database::submit(std::unique_ptr<PrintJob> job, std::string_view text,
+					  std::chrono::steady_clock::time_point started)
+{
+	job->text = text;
+	job->started = started;
+	job->plan.snapshot = true;
+	_sessions.find(job->user)->second.busy = true;
+	++_jobs;
+	Metrics::local().snapshot_reads.add();
+	_readers->submit([this, job = job.release()] {
+		On_Reader_Thread = true;
+		{
+			TRACE_SPAN("print on a snapshot");
+			job->result = print_rows(*job->snapshot, job->select_query, job->path, job->query, job->arena, job->plan);
+		}
+		/* Снимок отпустит finished(): писатель не должен менять страницу, пока здесь её ещё читают. */
+		std::lock_guard<std::mutex> lock(_finished_mutex);
+		_finished.emplace_back(job);
+		char byte = 0;
+		if (write(_finished_pipe[1], &byte, 1) < 0 && errno != EAGAIN)
+			perror("Database cannot notify about a finished query");
+	});
+}
+
+
+void Database::flush_logs()
 {
-	static const Scripts ret{
-		{STOP, &Database::remove_user},
-		{SHUTDOWN, &Database::shutdown},
-		{INSERT, &Database::insert},
-		{REMOVE, &Database::remove},
-		{SELECT, &Database::select},
-		{RESELECT, &Database::reselect},
-		{PRINT, &Database::print}};
-	return ret;
+	if (_journal == nullptr)
+		return;
+	for (Journal::Batch &log : _day_logs)
+		if (!log.empty())
+			_journal->append(log);
+}
+
+
+Database::Session& Database::open_session(const UserId &user)
+{
+	auto session = _sessions.find(user);
+	if (session == _sessions.end())
+		throw DatabaseExcUser("User not registered!");
+	assert(!session->second.busy && "The previous query is still running");
+	session->second.arena.release(); // ответ на предыдущий запрос уже отправлен
+	session->second.plan = Plan();
+	return session->second;
+}
+
+
+bool Database::parse(std::string_view str, AnyQuery &query, QueryResult &error,
+					 std::chrono::steady_clock::time_point started) const
+{
+	const char *refusal = nullptr;
+	try {
+		TRACE_SPAN("parse_query");
+		query = parse_query(str);
+	} catch (const QueryExc &e) {
+		refusal = e.what();
+	}
+	if (refusal == nullptr && _replica) {
+		const PrepareQuery *prepare_query = std::get_if<PrepareQuery>(&query);
+		if (std::holds_alternative<InsertQuery>(query) || std::holds_alternative<RemoveQuery>(query) ||
+			std::holds_alternative<TruncateQuery>(query) ||
+			(prepare_query != nullptr && (prepare_query->command() == INSERT || prepare_query->command() == REMOVE)))
+			refusal = "This server is a read-only replica!";
+		else if (_stale && (std::holds_alternative<PrintQuery>(query) || std::holds_alternative<AggregateQuery>(query) ||
+				 std::holds_alternative<FreeQuery>(query) || std::holds_alternative<ExplainQuery>(query)))
+			refusal = "The replica is behind the primary server, try later!";
+	}
+	if (refusal == nullptr)
+		return true;
+	error.set_protcode(ERROR);
+	error.set_info(refusal);
+	error.set_servcode(SEND_INFO);
+	Metrics::record_query(VOID, true, nanos_since(started));
+	return false;
+}
+
+
+QueryResult Database::run(const UserId &user, std::string_view str, const AnyQuery &query,
+						  std::chrono::steady_clock::time_point started)
+{
+	QueryResult result = std::visit(Dispatcher{*this, user}, query);
+	flush_logs();
+	if (result.get_servcode() == ANSWER_LATER) {
+		submit(std::move(_deferred), str, started); // время и ошибки учтёт finished()
+		return result;
+	}
+	account(user, str, query, result, nanos_since(started));
+	return result;
+}
+
+
+void Database::account(const UserId &user, std::string_view str, const AnyQuery &query, const QueryResult &result,
+					   uint64_t ns)
+{
+	QueryType type = std::visit([](const Query &q) { return q.type(); }, query);
+	Metrics::record_query(type, result.get_protcode() == ERROR, ns);
+	if (_slow_threshold_ns > 0 && ns >= _slow_threshold_ns) {
+		auto session = _sessions.find(user); // после stop сессии уже нет
+		log_slow(user, str, ns, session != _sessions.end() ? session->second.plan : Plan());
+	}
+}
+
+
+std::optional<int> Database::partition(const Session &session, const AnyQuery &query)
+{
+	auto single_day = [](const std::vector<Condition> &conds) -> std::optional<int> {
+		for (const auto &cond : conds) {
+			if (cond.field != DAY)
+				continue;
+			std::pair<int, int> range = cond.get_range();
+			if (range.first == range.second)
+				return range.first;
+		}
+		return std::nullopt;
+	};
+
+	if (const InsertQuery *insert_query = std::get_if<InsertQuery>(&query))
+		return single_day(insert_query->conditions());
+	if (const RemoveQuery *remove_query = std::get_if<RemoveQuery>(&query))
+		return single_day(remove_query->conditions());
+	if (const ExecuteQuery *execute_query = std::get_if<ExecuteQuery>(&query)) {
+		if (size_t(execute_query->handle()) >= session.prepared.size())
+			return std::nullopt;
+		const PrepareQuery &stmt = session.prepared[execute_query->handle()].query;
+		if (stmt.command() != INSERT && stmt.command() != REMOVE)
+			return std::nullopt;
+		try {
+			Lexer values(execute_query->values());
+			return single_day(stmt.bind(values));
+		} catch (const QueryExc &) {
+			return std::nullopt; // об ошибке сообщит сам execute
+		}
+	}
+	return std::nullopt;
+}
+
+
+/*
+ * Изменения разных дней не затрагивают ни общих ячеек, ни общих индексов, ни общих групп журнала,
+ * поэтому, если дней в группе несколько, каждый день исполняет свой поток в порядке поступления
+ * запросов, без блокировок. Иначе передавать работу потокам дороже, чем сделать её здесь.
+ */
+void Database::run_writes(const std::vector< std::pair<UserId, std::string_view> > &batch,
+						  std::vector<LocalWrite> &writes, std::vector<QueryResult> &results)
+{
+	std::vector<LocalWrite *> by_day[NUM_OF_DAYS];
+	int days = 0;
+	for (LocalWrite &write : writes) {
+		if (by_day[write.day - 1].empty())
+			++days;
+		by_day[write.day - 1].push_back(&write);
+	}
+
+	if (days < 2 || writes.size() < PARTITION_MIN_WRITES) {
+		for (const LocalWrite &write : writes) {
+			const auto &[user, str] = batch[write.index];
+			results[write.index] = run(user, str, write.query, write.started);
+		}
+		writes.clear();
+		return;
+	}
+
+	TRACE_SPAN("Database::run_writes");
+	std::latch done(days);
+	for (int d = 0; d < NUM_OF_DAYS; ++d) {
+		if (by_day[d].empty())
+			continue;
+		_partitions[d]->submit([this, &batch, &results, &done, &day = by_day[d]] {
+			On_Day_Thread = true;
+			for (LocalWrite *write : day) {
+				results[write->index] = std::visit(Dispatcher{*this, batch[write->index].first}, write->query);
+				write->ns = nanos_since(write->started);
+			}
+			done.count_down();
+		});
+	}
+	done.wait();
+	flush_logs();
+	for (const LocalWrite &write : writes) {
+		const auto &[user, str] = batch[write.index];
+		account(user, str, write.query, results[write.index], write.ns);
+	}
+	writes.clear();
 }
 
 
 /* -----------------------------------------PUBLIC METHODS--------------------------------------- */
 
 
+Database::~Database()
+{
+	_readers.reset();
+	for (int fd : _finished_pipe)
+		if (fd >= 0)
+			close(fd);
+}
+
+
 void Database::from_file(const std::string &filename)
 {
 	std::ifstream fin;
@@ -323,46 +997,198 @@ void Database::from_file(const std::string &filename)
 	if (!fin.is_open())
 		throw DatabaseExcFile("Database: cannot open the file!");
 	Record record;
+	add_user(0); // это  id точно не занят
 	while (fin >> record) {
-		InsertQuery query = record;
-		insert(0, &query); // это  id точно не занят
+		insert(0, InsertQuery(record));
 	}
 	fin.close();
+	_sessions.erase(0);
 }
 
 
+/* Снимок пишется во временный файл и атомарно подменяет прежний, чтобы сбой не оставил его
+ * наполовину записанным. */
 void Database::to_file(const std::string &filename) const
 {
+	const std::string tmp = filename + ".tmp";
 	std::ofstream fout;
-	fout.open(filename);
+	fout.open(tmp);
 	if (!fout.is_open())
 		throw DatabaseExcFile("Database: cannot open the file!");
 	for (int i = 0; i < NUM_OF_PERIODS * NUM_OF_DAYS; ++i)
 		for (int j = 0; j <= NUM_OF_ROOMS; ++j)
-			if (!_schedule[i][j].empty())
-				fout << get_record({i, j}) << '\n';
+			if (!_data.cell(SchedulePosition(Time(i), j)).empty())
+				fout << _data.get_record(SchedulePosition(Time(i), j)) << '\n';
 	fout.close();
+	if (fout.fail())
+		throw DatabaseExcFile("Database: cannot write the file!");
+
+	int fd = open(tmp.c_str(), O_RDONLY);
+	if (fd < 0 || fsync(fd) < 0) {
+		if (fd >= 0)
+			close(fd);
+		throw DatabaseExcFile("Database: cannot sync the file!");
+	}
+	close(fd);
+	if (std::rename(tmp.c_str(), filename.c_str()) < 0)
+		throw DatabaseExcFile("Database: cannot replace the file!");
 }
 
 
-QueryResult Database::process_query(const UserId &user, const std::string &str)
+/*
+ * Воспроизводит журнал поверх загруженного снимка. Операции журнала физические ("ячейка занята
+ * такой-то записью" / "ячейка свободна"), поэтому повторное воспроизведение уже учтённых в снимке
+ * операций ничего не портит.
+ */
+void Database::from_journal(const std::string &filename)
 {
-	if (!_sessions.contains(user))
-		throw DatabaseExcUser("User not registered!");
+	std::ifstream fin;
+	fin.open(filename);
+	if (!fin.is_open())
+		return; // журнала ещё нет - воспроизводить нечего
+	std::string line;
+	while (std::getline(fin, line)) {
+		if (fin.eof())
+			break; // последняя строка оборвана при сбое и не была подтверждена клиенту
+		apply(line);
+	}
+	fin.close();
+}
+
+
+void Database::apply(std::string_view line)
+{
+	if (line == "!") {
+		_data.truncate();
+		return;
+	}
+	if (line.size() < 2 || (line[0] != '+' && line[0] != '-') || line[1] != ' ')
+		throw DatabaseExcFile("Database: the journal is corrupted!");
+	std::stringstream ss{std::string(line.substr(2))};
+	Record record;
+	record.time = Time(0, 0);
+	ss >> record;
+	if (record.teacher.empty() || record.subject.empty() ||
+		record.room < 0 || record.room > NUM_OF_ROOMS ||
+		record.time.day < 1 || record.time.day > NUM_OF_DAYS ||
+		record.time.period < 1 || record.time.period > NUM_OF_PERIODS)
+		throw DatabaseExcFile("Database: the journal is corrupted!");
+	SchedulePosition pos(record.time, record.room);
+	if (line[0] == '+')
+		_data.put(pos, record);
+	else
+		_data.erase(pos);
+}
+
+
+void Database::set_slow_log(const std::string &filename, int threshold_us)
+{
+	_slow_threshold_ns = std::max(threshold_us, 0) * uint64_t(1000);
+	if (_slow_threshold_ns == 0)
+		return;
+	_slow_log.open(filename, std::ios::app);
+	if (!_slow_log.is_open())
+		throw DatabaseExcFile("Database: cannot open the slow query log!");
+}
+
+
+QueryResult Database::process_query(const UserId &user, std::string_view str)
+{
+	open_session(user);
+	TRACE_SPAN("Database::process_query");
+	auto started = std::chrono::steady_clock::now();
+	AnyQuery query;
 	QueryResult result;
-	Query *query;
-	try {
-		query = Query::create_query(str);
-	} catch (const QueryExc &e) {
-		result.set_protcode(ERROR);
-		result.set_info(e.what());
-		result.set_servcode(SEND_INFO);
+	if (!parse(str, query, result, started))
 		return result;
+	return run(user, str, query, started);
+}
+
+
+/*
+ * Вставки и удаления в пределах одного дня копятся, пока не встретится запрос, которому нужна вся
+ * база; перед ним накопленное исполняется потоками дней (см. run_writes()). Запросы, которые меняют
+ * только свою сессию, изменениям не мешают и исполняются сразу.
+ */
+std::vector<QueryResult> Database::process_batch(const std::vector< std::pair<UserId, std::string_view> > &batch)
+{
+	std::vector<QueryResult> results(batch.size());
+	if (_partitions[0] == nullptr || batch.size() < PARTITION_MIN_WRITES) {
+		for (size_t i = 0; i < batch.size(); ++i)
+			results[i] = process_query(batch[i].first, batch[i].second);
+		return results;
 	}
-	QueryExecutor executor = scripts().at(query->type());
-	result = (this->*executor)(user, query);
-	delete query;
-	return result;
+
+	TRACE_SPAN("Database::process_batch");
+	std::vector<LocalWrite> writes;
+	for (size_t i = 0; i < batch.size(); ++i) {
+		const auto &[user, str] = batch[i];
+		Session &session = open_session(user);
+		auto started = std::chrono::steady_clock::now();
+		AnyQuery query;
+		if (!parse(str, query, results[i], started))
+			continue;
+		if (std::optional<int> day = partition(session, query)) {
+			writes.push_back({i, std::move(query), *day, started});
+			continue;
+		}
+		bool session_only = std::holds_alternative<SelectQuery>(query) ||
+			std::holds_alternative<ReselectQuery>(query) || std::holds_alternative<PrepareQuery>(query);
+		if (!session_only)
+			run_writes(batch, writes, results);
+		results[i] = run(user, str, query, started);
+	}
+	run_writes(batch, writes, results);
+	return results;
+}
+
+
+void Database::start_partitions()
+{
+	for (auto &partition : _partitions)
+		if (partition == nullptr)
+			partition = std::make_unique<ThreadPool>(1);
+}
+
+
+void Database::start_readers(size_t threads)
+{
+	if (_readers != nullptr || threads == 0)
+		return;
+	if (pipe2(_finished_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+		throw DatabaseExc("Database: cannot create a pipe for the reader threads!");
+	_readers = std::make_unique<ThreadPool>(threads);
+}
+
+
+std::vector< std::pair<Database::UserId, QueryResult> > Database::finished()
+{
+	char buf[64];
+	while (read(_finished_pipe[0], buf, sizeof(buf)) > 0)
+		continue;
+	std::vector< std::unique_ptr<PrintJob> > jobs;
+	{
+		std::lock_guard<std::mutex> lock(_finished_mutex);
+		jobs.swap(_finished);
+	}
+
+	std::vector< std::pair<UserId, QueryResult> > answers;
+	for (auto &job : jobs) {
+		uint64_t ns = nanos_since(job->started);
+		Metrics::record_query(PRINT, false, ns);
+		if (_slow_threshold_ns > 0 && ns >= _slow_threshold_ns)
+			log_slow(job->user, job->text, ns, job->plan);
+		--_jobs;
+		auto session = _sessions.find(job->user);
+		session->second.busy = false;
+		if (session->second.closed) {
+			job.reset(); // ответ лежит в памяти сессии
+			_sessions.erase(session);
+			continue;
+		}
+		answers.emplace_back(job->user, std::move(job->result));
+	}
+	return answers;
 }
 
 
@@ -375,14 +1201,124 @@ bool Database::add_user(const UserId &user)
 }
 
 
-QueryResult Database::remove_user(const UserId &user, const Query *query)
+QueryResult Database::remove_user(const UserId &user)
 {
-	assert((query == nullptr || query->type() == STOP) && "Incorrect call of \'remove_user\'");
 	QueryResult result;
-	if (_sessions.contains(user))
-		_sessions.erase(user);
+	auto session = _sessions.find(user);
+	if (session != _sessions.end()) {
+		if (session->second.busy)
+			session->second.closed = true; // фоновый поток ещё пишет ответ в её память
+		else
+			_sessions.erase(session);
+	}
 	result.set_protcode(QUIT);
 	result.set_servcode(DISCONNECT_USER);
 	return result;
 }
 
+
+std::vector<std::string> Database::stats_report() const
+{
+	using namespace std::chrono;
+	MetricsSnapshot m = Metrics::collect();
+	std::vector<std::string> lines;
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1);
+	auto flush = [&lines, &out]() {
+		lines.push_back(out.str());
+		out.str("");
+	};
+	auto us = [](uint64_t ns) { return ns / 1000.0; };
+	auto kib = [](size_t bytes) { return (bytes + 1023) / 1024; };
+
+	out << "uptime: " << duration_cast<seconds>(steady_clock::now() - Metrics::started()).count() << " s"; flush();
+	out << "sessions: " << _sessions.size(); flush();
+	out << "records: " << _data.records(); flush();
+	out << "bytes in: " << m.bytes_in << ", bytes out: " << m.bytes_out << ", io syscalls: " << m.io_syscalls; flush();
+	out << "rows scanned: " << m.rows_scanned << ", rows returned: " << m.rows_returned; flush();
+	out << "lookups: teacher index " << m.lookups[LOOKUP_TEACHER_INDEX] << ", subject index "
+		<< m.lookups[LOOKUP_SUBJECT_INDEX] << ", scan " << m.lookups[LOOKUP_SCAN]; flush();
+
+	for (int t = 0; t < NUM_OF_QUERY_TYPES; ++t) {
+		const MetricsSnapshot::Command &c = m.commands[t];
+		if (c.count == 0)
+			continue;
+		out << "command " << Query::command_name(QueryType(t)) << ": " << c.count << " queries, "
+			<< c.errors << " errors, latency us: avg " << us(c.total_ns / c.count)
+			<< ", p50 " << us(Metrics::percentile(c, 50)) << ", p90 " << us(Metrics::percentile(c, 90))
+			<< ", p99 " << us(Metrics::percentile(c, 99)) << ", max " << us(c.max_ns);
+		flush();
+	}
+
+	/* Индексы свои у каждого дня: имя, встречающееся в нескольких днях, учитывается в каждом. */
+	for (Field field : {TEACHER, SUBJECT}) {
+		size_t names = 0, buckets = 0, used = 0, longest = 0;
+		for (int d = 1; d <= NUM_OF_DAYS; ++d) {
+			const DayPage::NameSchedule &index = (field == TEACHER ? _data.day(d).teachers : _data.day(d).subjects);
+			auto [day_longest, day_used] = index.chains();
+			names += index.size();
+			buckets += index.buckets();
+			used += day_used;
+			longest = std::max(longest, day_longest);
+		}
+		out << "index " << (field == TEACHER ? "teachers" : "subjects") << ": " << names << " names in "
+			<< NUM_OF_DAYS << " days, " << buckets << " buckets, " << used << " chains in use, longest chain "
+			<< longest << ", mean chain " << (used ? double(names) / used : 0.0);
+		flush();
+	}
+	out << "snapshots: " << _jobs << " in use, " << _data.shared_pages() << " shared pages, "
+		<< m.snapshot_reads << " reads, " << m.pages_copied << " pages copied"; flush();
+
+	StorageMemory mem = _data.memory();
+	size_t sessions = 0;
+	for (const auto &[user, session] : _sessions)
+		sessions += session_memory(session);
+	out << "memory KiB: schedule " << kib(mem.cells + mem.strings + mem.idle_strings) << ", teachers index "
+		<< kib(mem.teachers.bytes()) << ", subjects index " << kib(mem.subjects.bytes()) << ", sessions " << kib(sessions);
+	flush();
+	return lines;
+}
+
+
+std::vector<std::string> Database::memory_report() const
+{
+	std::vector<std::string> lines;
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1);
+	auto flush = [&lines, &out]() {
+		lines.push_back(out.str());
+		out.str("");
+	};
+	auto kib = [](size_t bytes) { return (bytes + 1023) / 1024; };
+
+	/* Сколько памяти распределитель держит у себя свободной, и сколько из неё отдал бы по compact. */
+	struct mallinfo2 heap = mallinfo2();
+	out << "heap KiB: in use " << kib(heap.uordblks + heap.hblkhd) << ", free " << kib(heap.fordblks)
+		<< ", releasable " << kib(heap.keepcost) << ", mapped " << kib(heap.hblkhd); flush();
+
+	StorageMemory mem = _data.memory();
+	out << "schedule KiB: cells " << kib(mem.cells) << ", names " << kib(mem.strings)
+		<< ", names left in free cells " << kib(mem.idle_strings); flush();
+	for (Field field : {TEACHER, SUBJECT}) {
+		const StorageMemory::Index &index = (field == TEACHER ? mem.teachers : mem.subjects);
+		size_t slack = index.capacity - index.positions;
+		out << "index " << (field == TEACHER ? "teachers" : "subjects") << " KiB: table " << kib(index.table)
+			<< ", names " << kib(index.strings) << ", positions " << kib(index.capacity * sizeof(PackedPosition))
+			<< " (" << index.positions << " of " << index.capacity << " used, "
+			<< (index.capacity ? 100.0 * slack / index.capacity : 0.0) << "% unused), "
+			<< index.names << " names in " << index.buckets << " buckets";
+		flush();
+	}
+
+	size_t sessions = 0;
+	for (const auto &[user, session] : _sessions)
+		sessions += session_memory(session);
+	out << "sessions KiB: " << kib(sessions) << " in " << _sessions.size() << " sessions"; flush();
+	for (const auto &[user, session] : _sessions) {
+		out << "session " << user << " KiB: " << kib(session_memory(session)) << ", arena " << kib(ARENA_SIZE)
+			<< ", " << session.prepared.size() << " prepared queries" << (session.busy ? ", busy" : "");
+		flush();
+	}
+	out << "total KiB: " << kib(mem.bytes() + sessions); flush();
+	return lines;
+}
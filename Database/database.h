@@ -2,56 +2,231 @@
 #define DATABASE_H
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <array>
 #include <algorithm>
 #include <map>
+#include <unordered_map>
+#include <optional>
+#include <memory>
+#include <memory_resource>
 #include <fstream>
 #include <cassert>
+#include <mutex>
+#include <chrono>
 #include "DatabaseExc.h"
+#include "storage.h"
 #include "../Query/query.h"
-#include "../HashTable/HashTable.hpp"
+#include "../Journal/journal.h"
+#include "../Metrics/metrics.h"
+#include "../ThreadPool/thread_pool.h"
+#include "../Trace/trace.h"
 #include "../TaskStructures/task_structures.h"
 
+#define ARENA_SIZE (64 * 1024)	// память сессии под один запрос, сверх неё - обычная куча
+#define SNAPSHOT_PRINT_CELLS 8192	// print, которому предстоит проверить столько ячеек, идёт на снимке
+#define MAX_SNAPSHOTS 4				// одновременно исполняемых на снимках запросов (и версий страницы)
+#define PARTITION_MIN_WRITES 4		// изменения расходятся по потокам дней, если их в группе не меньше
+#define PARALLEL_SCAN_CELLS 16384	// поиск, которому предстоит проверить столько ячеек, идёт блоками параллельно
+#define PARALLEL_PRINT_ROWS 16384	// столько найденных строк print сортирует и форматирует параллельно
+#define BULK_REMOVE_SHARE 8			// remove, задевший не меньше 1/8 записей своих дней, освобождает ячейки разом
+
 class Database
 {
   private:
-	using NameSchedule = HashTable< std::string, std::vector<SchedulePosition> >;
-	
-	ScheduleItem _schedule[NUM_OF_PERIODS * NUM_OF_DAYS][NUM_OF_ROOMS + 1];
-	NameSchedule _teachers;
-	NameSchedule _subjects;
+	Storage _data;
 
 	using UserId = int;	// не хочу шаблон делать, некрасиво
+	struct Prepared {
+	  PrepareQuery query;
+	  std::optional<AccessPath> path;	// известен заранее, если не зависит от подставляемых значений
+	};
+	/* Как был исполнен поиск в запросе: для explain и журнала медленных запросов. */
+	struct Plan {
+	  bool done = false;		// поиск был
+	  bool printed = false;		// найденное сортировалось и форматировалось для print
+	  AccessPath path;
+	  size_t estimated = 0;		// сколько ячеек предстояло проверить по оценке до поиска
+	  size_t visited = 0;		// сколько проверено на самом деле
+	  size_t matches = 0;
+	  bool snapshot = false;	// исполнялся на снимке в фоновом потоке
+	  size_t blocks = 0;		// на сколько блоков разделился параллельный поиск (0 - искал один поток)
+	  uint64_t find_ns = 0, sort_ns = 0, format_ns = 0;
+	};
 	struct Session {
 	  SelectQuery select_query;
+	  std::optional<AccessPath> select_path;
 	  QueryType last_query;
+	  std::vector<Prepared> prepared;
+	  bool busy = false;	// исполняется на снимке: до ответа новые запросы сессии не принимаются
+	  bool closed = false;	// пользователь удалён, пока сессия была занята: её удалит finished()
+	  Plan plan;			// план текущего запроса
+	  /* Всё, что выделяется при исполнении запроса, освобождается разом перед следующим. */
+	  std::unique_ptr<std::byte[]> arena_buffer;
+	  std::pmr::monotonic_buffer_resource arena;
+
+	  Session() : arena_buffer(new std::byte[ARENA_SIZE]), arena(arena_buffer.get(), ARENA_SIZE) {}
 	};
 	std::map<UserId, Session> _sessions;
 
-	static void name_remove(NameSchedule &ns, const std::string &name, const SchedulePosition &pos);
-	Record get_record(const SchedulePosition &pos) const;
-	bool match(const SchedulePosition &pos, const Condition &cond) const;
-	bool match(const SchedulePosition &pos, const ConditionalQuery &query) const;
-	std::vector<SchedulePosition> find(const ConditionalQuery &query) const;
+	Journal *_journal = nullptr;	// куда записываются изменения (если журнал подключён)
+	/* Изменения каждого дня, ещё не переданные в журнал: поток дня пишет только в свою группу. */
+	std::array<Journal::Batch, NUM_OF_DAYS> _day_logs;
+
+	bool _replica = false;	// изменения приходят только от ведущего сервера через apply()
+	bool _stale = false;	// реплика отстала от ведущего: запросы к данным не исполняются
+
+	std::ofstream _slow_log;
+	uint64_t _slow_threshold_ns = 0;	// 0 - журнал медленных запросов не ведётся
+
+	/* Долгий print, отправленный исполняться на снимке базы в фоновый поток. */
+	struct PrintJob {
+	  UserId user;
+	  std::optional<Storage> snapshot;
+	  SelectQuery select_query;
+	  AccessPath path;
+	  PrintQuery query;
+	  std::pmr::memory_resource *arena;	// память сессии: до ответа она не освобождается и никем не используется
+	  std::string text;					// текст запроса для журнала медленных запросов
+	  std::chrono::steady_clock::time_point started;
+	  Plan plan;
+	  QueryResult result;
+	};
+	std::unique_ptr<PrintJob> _deferred;	// print текущего запроса, если его решено исполнить на снимке
+	size_t _jobs = 0;						// запросов, исполняемых на снимках
+	std::mutex _finished_mutex;
+	std::vector< std::unique_ptr<PrintJob> > _finished;
+	int _finished_pipe[2] = {-1, -1};		// в него пишется байт на каждый исполненный запрос
+
+	static std::optional<AccessPath> choose_path(const PrepareQuery &query);
+	bool exists(const ConditionalQuery &query) const;
+	using Positions = std::pmr::vector<PackedPosition>;
+	Positions find(const Storage &data, const ConditionalQuery &query, AccessPath path,
+				   std::pmr::memory_resource *mr, Plan &plan) const;
+	QueryResult remove_by(const UserId &user, const ConditionalQuery &query, AccessPath path);
+	QueryResult select_by(const UserId &user, const SelectQuery &query, std::optional<AccessPath> path);
+	void sort_positions(const Storage &data, Positions &positions, const PrintQuery &query, Plan &plan) const;
+	QueryResult::Rows format_rows(const Storage &data, const Positions &positions, const PrintQuery &query,
+								  std::pmr::memory_resource *mr, Plan &plan) const;
+	/* Поиск по выборке, сортировка и форматирование - всё, что делает print, на данных data. */
+	QueryResult print_rows(const Storage &data, const SelectQuery &select_query, AccessPath path,
+						   const PrintQuery &query, std::pmr::memory_resource *mr, Plan &plan) const;
+	/* Ставит отложенный print в очередь фоновых потоков. */
+	void submit(std::unique_ptr<PrintJob> job, std::string_view text,
+				std::chrono::steady_clock::time_point started);
+	static std::vector<std::string> plan_report(const Plan &plan);
+	void log_slow(const UserId &user, std::string_view query, uint64_t ns, const Plan &plan);
+	/* Передаёт в журнал изменения, накопленные по дням. */
+	void flush_logs();
+
+	/* Находит сессию пользователя и готовит её к новому запросу. */
+	Session& open_session(const UserId &user);
+	/* Разбирает запрос; если он с ошибкой или недоступен на реплике, заполняет ответ на него и возвращает false. */
+	bool parse(std::string_view str, AnyQuery &query, QueryResult &error,
+			   std::chrono::steady_clock::time_point started) const;
+	/* Исполняет разобранный запрос в этом потоке. */
+	QueryResult run(const UserId &user, std::string_view str, const AnyQuery &query,
+					std::chrono::steady_clock::time_point started);
+	/* Учитывает исполненный запрос в метриках и журнале медленных запросов. */
+	void account(const UserId &user, std::string_view str, const AnyQuery &query, const QueryResult &result,
+				 uint64_t ns);
+
+	/* Изменение одного дня из группы запросов, ждущее исполнения в потоке этого дня. */
+	struct LocalWrite {
+	  size_t index;		// номер запроса в группе
+	  AnyQuery query;
+	  int day;
+	  std::chrono::steady_clock::time_point started;
+	  uint64_t ns = 0;
+	};
+	/* День, которым ограничено изменение, если запрос - вставка или удаление в пределах одного дня. */
+	static std::optional<int> partition(const Session &session, const AnyQuery &query);
+	/* Можно ли из этого потока раздать работу потокам дней. */
+	bool can_parallel() const;
+	/* Исполняет task(0), ..., task(n - 1) в потоках дней и дожидается всех. */
+	template <class Task>
+	void parallel(size_t n, Task task) const;
+	/* Исполняет накопленные изменения отдельных дней и очищает writes. */
+	void run_writes(const std::vector< std::pair<UserId, std::string_view> > &batch, std::vector<LocalWrite> &writes,
+					std::vector<QueryResult> &results);
+
+	QueryResult insert(const UserId &user, const InsertQuery &query);
+	QueryResult remove(const UserId &user, const RemoveQuery &query);
+	QueryResult select(const UserId &user, const SelectQuery &query);
+	QueryResult reselect(const UserId &user, const ReselectQuery &query);
+	QueryResult print(const UserId &user, const PrintQuery &query);
+	QueryResult prepare(const UserId &user, const PrepareQuery &query);
+	QueryResult execute(const UserId &user, const ExecuteQuery &query);
+	QueryResult shutdown(const UserId &user);
+	QueryResult stats(const UserId &user);
+	QueryResult explain(const UserId &user, const ExplainQuery &query);
+	QueryResult trace(const UserId &user);
+	QueryResult aggregate(const UserId &user, const AggregateQuery &query);
+	QueryResult free_slots(const UserId &user, const FreeQuery &query);
+	QueryResult truncate(const UserId &user);
+	QueryResult memory(const UserId &user);
+	QueryResult compact(const UserId &user);
+
+	/* Память сессии: сама сессия, её буфер и запросы, которые она хранит. */
+	static size_t session_memory(const Session &session);
 
-	QueryResult insert(const UserId &user, const Query *query);
-	QueryResult remove(const UserId &user, const Query *query);
-	QueryResult select(const UserId &user, const Query *query);
-	QueryResult reselect(const UserId &user, const Query *query);
-	QueryResult print(const UserId &user, const Query *query);
-	QueryResult shutdown(const UserId &user, const Query *query = nullptr);
+	/* Посетитель для std::visit, вызывающий исполнителя нужного вида запроса. */
+	struct Dispatcher;
 
-	using QueryExecutor = QueryResult (Database::*)(const UserId&, const Query *);
-	using Scripts = std::map<QueryType, QueryExecutor>;
-	static const Scripts& scripts();
+	/*
+	 * Потоки объявлены последними, чтобы при разрушении базы сначала дождаться их задач. Поток
+	 * каждого дня исполняет изменения этого дня, а в остальное время - блоки параллельного поиска,
+	 * сортировки и форматирования, которые раздаёт главный поток. Печать на снимке фоновый поток
+	 * исполняет сам, не занимая потоки дней.
+	 */
+	std::array<std::unique_ptr<ThreadPool>, NUM_OF_DAYS> _partitions;
+	std::unique_ptr<ThreadPool> _readers;
 
   public:
 	Database() {}
+	Database(const Database &) = delete;
+	Database& operator=(const Database &) = delete;
+	~Database();
 	void from_file(const std::string &filename);
 	void to_file(const std::string &filename) const;
-	QueryResult process_query(const UserId &user, const std::string &str);
+	void from_journal(const std::string &filename);
+	/* Применяет одну строку журнала (см. Journal). */
+	void apply(std::string_view line);
+	/* Текущее расписание; копия разделяет страницы с базой, пока их никто не изменит. */
+	Storage snapshot() const { return _data; }
+	/* Делает базу репликой: insert, remove и truncate отвергаются, изменения вносит apply(). */
+	void set_replica(bool replica) { _replica = replica; }
+	/* Пока реплика отстаёт, на print, aggregate, count, free и explain отвечается ошибкой. */
+	void set_stale(bool stale) { _stale = stale; }
+	void set_journal(Journal *journal) { _journal = journal; }
+	/* Запросы дольше threshold_us микросекунд записываются в filename вместе с планом (0 - не записываются). */
+	void set_slow_log(const std::string &filename, int threshold_us);
+	/*
+	 * Исполняет запрос. Если ответ помечен ANSWER_LATER, запрос исполняется на снимке в фоновом
+	 * потоке: до получения ответа из finished() новых запросов этого пользователя передавать нельзя.
+	 */
+	QueryResult process_query(const UserId &user, std::string_view str);
+	/*
+	 * Исполняет запросы разных пользователей, пришедшие одновременно, с тем же результатом, что и
+	 * process_query() по очереди. Пользователи в группе не повторяются.
+	 */
+	std::vector<QueryResult> process_batch(const std::vector< std::pair<UserId, std::string_view> > &batch);
+	/* Заводит по потоку на каждый день: они исполняют изменения своих дней и блоки долгих print. */
+	void start_partitions();
+	/* Включает исполнение долгих print на снимках в threads фоновых потоках. */
+	void start_readers(size_t threads);
+	/* Становится доступен для чтения, когда есть ответы в finished() (-1, если потоков нет). */
+	int finished_fd() const { return _finished_pipe[0]; }
+	/* Ответы на отложенные запросы, исполнение которых завершилось. */
+	std::vector< std::pair<UserId, QueryResult> > finished();
 	bool add_user(const UserId &user);
-	QueryResult remove_user(const UserId &user, const Query *query = nullptr);
+	/* Сессия, занятая отложенным запросом, удаляется, когда он завершится; ответа на него не будет. */
+	QueryResult remove_user(const UserId &user);
+	/* Показатели сервера и базы данных построчно в виде "название: значение". */
+	std::vector<std::string> stats_report() const;
+	/* Память по структурам, индексам и сессиям построчно. */
+	std::vector<std::string> memory_report() const;
 };
 
 #endif // DATABASE_H
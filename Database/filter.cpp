@@ -0,0 +1,59 @@
+#include "filter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_X86
+#endif
+
+
+static size_t select_scalar(const int16_t *groups, int from, int to, int lo, int hi, uint64_t *mask)
+{
+	size_t selected = 0;
+	for (int r = from; r <= to; ++r) {
+		bool hit = groups[r] >= lo && groups[r] <= hi; // пустая ячейка (-1) сюда не попадает
+		mask[r / 64] |= uint64_t(hit) << (r % 64);
+		selected += hit;
+	}
+	return selected;
+}
+
+
+#ifdef FILTER_X86
+
+/*
+ * Строка читается по 16 аудиторий, начиная с кратной 16: так блок не пересекает слов маски, а
+ * чтение не выходит за ROOM_STRIDE. Лишние аудитории по краям отрезаются от маски блока.
+ */
+__attribute__((target("avx2")))
+static size_t select_avx2(const int16_t *groups, int from, int to, int lo, int hi, uint64_t *mask)
+{
+	const __m256i below = _mm256_set1_epi16(lo - 1), above = _mm256_set1_epi16(hi + 1);
+	size_t selected = 0;
+	for (int base = from & ~15; base <= to; base += 16) {
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(groups + base));
+		__m256i hit = _mm256_and_si256(_mm256_cmpgt_epi16(x, below), _mm256_cmpgt_epi16(above, x));
+		/* 16-битные флаги сжимаются в байты (packs работает в половинах регистра, permute их сводит). */
+		__m256i bytes = _mm256_permute4x64_epi64(_mm256_packs_epi16(hit, _mm256_setzero_si256()), 0xD8);
+		uint32_t bits = uint32_t(_mm256_movemask_epi8(bytes)) & 0xFFFF;
+		if (base < from)
+			bits &= ~0u << (from - base);
+		if (to - base < 15)
+			bits &= (1u << (to - base + 1)) - 1;
+		mask[base / 64] |= uint64_t(bits) << (base % 64);
+		selected += __builtin_popcount(bits);
+	}
+	return selected;
+}
+
+#endif // FILTER_X86
+
+
+size_t select_groups(const int16_t *groups, int from, int to, int lo, int hi, uint64_t *mask)
+{
+#ifdef FILTER_X86
+	static const bool avx2 = FILTER_AVX2 && __builtin_cpu_supports("avx2");
+	if (avx2)
+		return select_avx2(groups, from, to, lo, hi, mask);
+#endif
+	return select_scalar(groups, from, to, lo, hi, mask);
+}
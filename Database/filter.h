@@ -0,0 +1,24 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <cstdint>
+#include <cstddef>
+#include "../TaskStructures/task_structures.h"
+
+#define FILTER_AVX2 1	// 1 - векторный фильтр на AVX2, если процессор его поддерживает, 0 - всегда обычный
+
+/* Длина строки столбца групп: аудитории плюс запас, чтобы векторное чтение не выходило за строку. */
+#define ROOM_STRIDE ((NUM_OF_ROOMS + 1 + 15) / 16 * 16)
+/* Сколько 64-битных слов в маске одной строки. */
+#define ROOM_WORDS ((ROOM_STRIDE + 63) / 64)
+static_assert(NUM_OF_GROUPS < INT16_MAX, "A group number does not fit in the int16_t group column");
+
+/*
+ * Фильтр по столбцу номеров групп одной строки (дня и пары), где пустой ячейке соответствует -1.
+ * Отмечает в mask аудитории from..to, ячейки которых заняты группой с номером из [lo, hi]:
+ * аудитории r соответствует бит r % 64 слова r / 64. Другие биты mask не трогает. lo не меньше 0.
+ * Возвращает число отмеченных аудиторий.
+ */
+size_t select_groups(const int16_t *groups, int from, int to, int lo, int hi, uint64_t *mask);
+
+#endif // FILTER_H
@@ -0,0 +1,58 @@
+#include <algorithm>
+#include <cassert>
+#include "predicate.h"
+
+
+Predicate::Predicate(const ConditionalQuery &query, AccessPath path) : path(path)
+{
+	std::pair<int, int> day = {1, NUM_OF_DAYS}, period = {1, NUM_OF_PERIODS};
+	for (const auto &cond : query.conditions()) {
+		if (cond.field == TEACHER || cond.field == SUBJECT) {
+			const auto &name = std::get<std::string>(cond.value);
+			bool indexed = (path == TEACHER_INDEX && cond.field == TEACHER) || (path == SUBJECT_INDEX && cond.field == SUBJECT);
+			if (indexed && cond.relation == EQUAL) {
+				key = &name;
+				continue;
+			}
+			/* На каждое поле не больше одного условия (см. sort_conditions), так что имён не больше двух. */
+			assert(num_names < int(names.size()) && "One field - one condition");
+			names[num_names++] = {cond.field == TEACHER ? &ScheduleItem::teacher : &ScheduleItem::subject,
+								  cond.relation == EQUAL, name};
+		} else if (cond.field == ROOM) {
+			room = cond.get_range();
+		} else if (cond.field == DAY) {
+			day = cond.get_range();
+		} else if (cond.field == PERIOD) {
+			period = cond.get_range();
+		} else if (cond.field == GROUP) {
+			group = cond.get_range();
+		}
+	}
+
+	/* Точное имя отсекает больше, чем префикс, а длинный префикс - больше, чем короткий. */
+	std::sort(names.begin(), names.begin() + num_names, [](const Name &n1, const Name &n2) {
+		if (n1.exact != n2.exact)
+			return n1.exact;
+		return n1.text.size() > n2.text.size();
+	});
+
+	uint64_t periods = 0;
+	for (int p = period.first; p <= period.second; ++p)
+		periods |= uint64_t(1) << (p - 1);
+	times = 0;
+	for (int d = day.first; d <= day.second; ++d)
+		times |= periods << Time(d, 1);
+	if (room.first > room.second || group.first > group.second)
+		times = 0;
+}
+
+
+void Predicate::restrict(int first, int last)
+{
+	if (first > last) {
+		times = 0;
+		return;
+	}
+	uint64_t upto_last = (last + 1 >= 64 ? ~uint64_t(0) : (uint64_t(1) << (last + 1)) - 1);
+	times &= upto_last & ~((uint64_t(1) << first) - 1);
+}
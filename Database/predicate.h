@@ -0,0 +1,78 @@
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "../Query/query.h"
+#include "../TaskStructures/task_structures.h"
+
+/* Способ перебора кандидатов (порядок совпадает с LookupType). */
+typedef enum { TEACHER_INDEX, SUBJECT_INDEX, FULL_SCAN } AccessPath;
+
+static_assert(NUM_OF_DAYS * NUM_OF_PERIODS <= 64, "A timecode mask does not fit in 64 bits");
+
+/*
+ * Условия запроса, разобранные один раз перед перебором. Числовые условия сведены к отрезкам
+ * (EQUAL - отрезок из одного числа), день и пара - к маске допустимых timecode, а условия на
+ * имена упорядочены по избирательности: точные имена раньше префиксов, длинные префиксы раньше
+ * коротких. Проверка ячейки уже не смотрит ни на поле, ни на отношение условия.
+ */
+class Predicate
+{
+  public:
+	static constexpr uint64_t ALL_TIMES = ~uint64_t(0) >> (64 - NUM_OF_DAYS * NUM_OF_PERIODS);
+
+	/* Условие на имя: с каким полем ячейки сравнивать и что должно совпасть. */
+	struct Name {
+	  std::string ScheduleItem::*field;
+	  bool exact;			// имя целиком, иначе только его начало
+	  std::string_view text;
+	};
+
+	AccessPath path;
+	std::pair<int, int> room = {0, NUM_OF_ROOMS};
+	std::pair<int, int> group = {0, NUM_OF_GROUPS};
+	uint64_t times = ALL_TIMES;			// бит t стоит, если timecode t подходит по дню и паре
+	const std::string *key = nullptr;	// точное имя, по списку которого в индексе идёт перебор
+	std::array<Name, 2> names;			// условия на имена, которые не проверяют ни индекс, ни фильтр
+	int num_names = 0;
+
+	/* Если запросу заведомо ничто не подходит, times пуст. */
+	Predicate(const ConditionalQuery &query, AccessPath path);
+	/* Оставляет только timecode из [first, last]. */
+	void restrict(int first, int last);
+
+	template <int Names>
+	bool names_match(const ScheduleItem &item) const;
+	/* Проверка позиции из списка индекса: ячейка заведомо занята, а имя-ключ совпадает. */
+	template <int Names>
+	bool indexed_match(const SchedulePosition &pos, const ScheduleItem &item) const;
+};
+
+
+template <int Names>
+bool Predicate::names_match(const ScheduleItem &item) const
+{
+	for (int i = 0; i < Names; ++i) {
+		const std::string &candidate = item.*names[i].field;
+		if (names[i].exact ? candidate != names[i].text : !candidate.starts_with(names[i].text))
+			return false;
+	}
+	return true;
+}
+
+
+/* Отрезки непусты (иначе times пуст), поэтому попадание в них - одно беззнаковое сравнение. */
+template <int Names>
+bool Predicate::indexed_match(const SchedulePosition &pos, const ScheduleItem &item) const
+{
+	return ((times >> pos.timecode) & 1) &
+		(unsigned(pos.room - room.first) <= unsigned(room.second - room.first)) &
+		(unsigned(item.group - group.first) <= unsigned(group.second - group.first)) &&
+		names_match<Names>(item);
+}
+
+#endif // PREDICATE_H
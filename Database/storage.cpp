@@ -0,0 +1,361 @@
+#include <charconv>
+#include "storage.h"
+
+
+void append_int(std::pmr::string &str, int number)
+{
+	char buf[16];
+	auto res = std::to_chars(buf, buf + sizeof(buf), number);
+	str.append(buf, res.ptr);
+}
+
+
+/* -----------------------------------------PRIVATE METHODS-------------------------------------- */
+
+
+void Storage::name_remove(DayPage::NameSchedule &ns, const std::string &name, const SchedulePosition &pos)
+{
+	auto it = ns.find(name);
+	auto &positions = it.val();
+	int n = positions.size();
+	PackedPosition packed = pos;
+	for (int i = 0; i < n-1; ++i) {
+		if (positions[i] == packed) {
+			positions[i] = positions[n - 1];
+			break;
+		}
+	}
+	positions.pop_back();
+	if (positions.empty())
+		ns.erase(name);
+}
+
+
+/*
+ * use_count() читается без синхронизации. Снимок, отпущенный в другом потоке, уменьшает счётчик
+ * с release, и барьер acquire после чтения счётчика упорядочивает все чтения страницы тем потоком
+ * до записей в неё.
+ */
+bool Storage::sole_owner(const std::shared_ptr<DayPage> &page)
+{
+	if (page.use_count() > 1)
+		return false;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return true;
+}
+
+
+DayPage& Storage::writable(int day)
+{
+	std::shared_ptr<DayPage> &page = _days[day - 1];
+	if (!sole_owner(page)) {
+		page = std::make_shared<DayPage>(*page);
+		Metrics::local().pages_copied.add();
+	}
+	return *page;
+}
+
+
+/* Страницу, которую держит снимок, не чистим, а заменяем пустой: снимок сохранит старую. */
+void Storage::clear_day(int day)
+{
+	std::shared_ptr<DayPage> &page = _days[day - 1];
+	if (page->records == 0)
+		return;
+	if (!sole_owner(page)) {
+		page = std::make_shared<DayPage>();
+		return;
+	}
+	page->teachers.for_each([&page](const std::string &, const std::vector<PackedPosition> &positions) {
+		for (SchedulePosition pos : positions) {
+			page->cells[pos.timecode % NUM_OF_PERIODS][pos.room].clear();
+			page->groups[pos.timecode % NUM_OF_PERIODS][pos.room] = -1;
+		}
+	});
+	page->teachers.clear();
+	page->subjects.clear();
+	page->records = 0;
+}
+
+
+/* -----------------------------------------PUBLIC METHODS--------------------------------------- */
+
+
+Storage::Storage()
+{
+	for (auto &page : _days)
+		page = std::make_shared<DayPage>();
+}
+
+
+void Storage::put(const SchedulePosition &pos, const Record &record)
+{
+	erase(pos);
+	DayPage &page = writable(Time(pos.timecode).day);
+	page.cells[pos.timecode % NUM_OF_PERIODS][pos.room] = record;
+	page.groups[pos.timecode % NUM_OF_PERIODS][pos.room] = record.group;
+	++page.records;
+	page.teachers[record.teacher].push_back(pos);
+	page.subjects[record.subject].push_back(pos);
+}
+
+
+void Storage::erase(const SchedulePosition &pos)
+{
+	if (cell(pos).empty())
+		return;
+	DayPage &page = writable(Time(pos.timecode).day);
+	ScheduleItem &item = page.cells[pos.timecode % NUM_OF_PERIODS][pos.room];
+	name_remove(page.teachers, item.teacher, pos);
+	name_remove(page.subjects, item.subject, pos);
+	item.clear();
+	page.groups[pos.timecode % NUM_OF_PERIODS][pos.room] = -1;
+	--page.records;
+}
+
+
+void Storage::erase_all(std::span<const PackedPosition> positions)
+{
+	std::array<size_t, NUM_OF_DAYS> occupied = {};
+	for (SchedulePosition pos : positions)
+		if (!cell(pos).empty())
+			++occupied[pos.timecode / NUM_OF_PERIODS];
+
+	std::array<bool, NUM_OF_DAYS> partly = {};	// из дня удаляется не всё
+	for (int d = 1; d <= NUM_OF_DAYS; ++d) {	// страницы других дней в это время может менять их поток
+		if (occupied[d - 1] == 0)
+			continue;
+		if (occupied[d - 1] == _days[d - 1]->records)
+			clear_day(d);
+		else
+			partly[d - 1] = true;
+	}
+
+	for (SchedulePosition pos : positions) {
+		if (!partly[pos.timecode / NUM_OF_PERIODS] || cell(pos).empty())
+			continue;
+		DayPage &page = writable(Time(pos.timecode).day);
+		page.cells[pos.timecode % NUM_OF_PERIODS][pos.room].clear();
+		page.groups[pos.timecode % NUM_OF_PERIODS][pos.room] = -1;
+		--page.records;
+	}
+	for (int d = 1; d <= NUM_OF_DAYS; ++d) {
+		if (!partly[d - 1])
+			continue;
+		DayPage &page = writable(d);
+		auto vacate = [&page](const std::string &, std::vector<PackedPosition> &list) {
+			std::erase_if(list, [&page](SchedulePosition pos) {
+				return page.cells[pos.timecode % NUM_OF_PERIODS][pos.room].empty();
+			});
+			return list.empty();
+		};
+		page.teachers.erase_if(vacate);
+		page.subjects.erase_if(vacate);
+	}
+}
+
+
+void Storage::truncate()
+{
+	for (int d = 1; d <= NUM_OF_DAYS; ++d)
+		clear_day(d);
+}
+
+
+size_t Storage::records() const
+{
+	size_t records = 0;
+	for (const auto &page : _days)
+		records += page->records;
+	return records;
+}
+
+
+size_t Storage::shared_pages() const
+{
+	size_t shared = 0;
+	for (const auto &page : _days)
+		if (page.use_count() > 1)
+			++shared;
+	return shared;
+}
+
+
+StorageMemory Storage::memory() const
+{
+	StorageMemory mem;
+	size_t sso = std::string().capacity();
+	auto heap = [sso](const std::string &str) { return str.capacity() > sso ? str.capacity() + 1 : 0; };
+	auto account = [&heap](const DayPage::NameSchedule &ns, StorageMemory::Index &index) {
+		index.names += ns.size();
+		index.buckets += ns.buckets();
+		index.table += ns.memory();
+		ns.for_each([&](const std::string &name, const std::vector<PackedPosition> &positions) {
+			index.strings += heap(name);
+			index.positions += positions.size();
+			index.capacity += positions.capacity();
+		});
+	};
+	for (const auto &page : _days) {
+		mem.cells += sizeof(page->cells) + sizeof(page->groups);
+		for (const auto &row : page->cells)
+			for (const ScheduleItem &item : row)
+				(item.empty() ? mem.idle_strings : mem.strings) += heap(item.teacher) + heap(item.subject);
+		account(page->teachers, mem.teachers);
+		account(page->subjects, mem.subjects);
+	}
+	return mem;
+}
+
+
+/* Цепочек не меньше, чем задано по умолчанию: на расписание, которое снова растёт, не перестраиваем. */
+size_t Storage::compact()
+{
+	size_t compacted = 0;
+	for (auto &page : _days) {
+		if (!sole_owner(page))
+			continue;
+		for (auto &row : page->cells) {
+			for (ScheduleItem &item : row) {
+				if (item.empty()) {
+					std::string().swap(item.teacher);
+					std::string().swap(item.subject);
+				} else {
+					item.teacher.shrink_to_fit();
+					item.subject.shrink_to_fit();
+				}
+			}
+		}
+		for (DayPage::NameSchedule *ns : {&page->teachers, &page->subjects}) {
+			ns->for_each([](const std::string &, std::vector<PackedPosition> &positions) {
+				positions.shrink_to_fit();
+			});
+			size_t hashes = std::max<size_t>(HASH_GROUPS, ns->size());
+			if (ns->buckets() != hashes)
+				ns->rehash(hashes);
+		}
+		++compacted;
+	}
+	return compacted;
+}
+
+
+Record Storage::get_record(const SchedulePosition &pos) const
+{
+	Record record;
+	const ScheduleItem &item = cell(pos);
+	record.teacher = item.teacher;
+	record.subject = item.subject;
+	record.room = pos.room;
+	record.time = pos.timecode;
+	record.group = item.group;
+	return record;
+}
+
+
+int Storage::numeric(const SchedulePosition &pos, Field field) const
+{
+	if (field == ROOM)
+		return pos.room;
+	else if (field == DAY)
+		return Time(pos.timecode).day;
+	else if (field == PERIOD)
+		return Time(pos.timecode).period;
+	else // GROUP
+		return cell(pos).group;
+}
+
+
+/* Поля читаются прямо из ячеек, чтобы не копировать строки. */
+bool Storage::less(const SchedulePosition &p1, const SchedulePosition &p2, const std::vector<Field> &by) const
+{
+	const ScheduleItem &i1 = cell(p1);
+	const ScheduleItem &i2 = cell(p2);
+	for (Field field : by) {
+		if (field == TEACHER) {
+			if (int c = i1.teacher.compare(i2.teacher); c != 0)
+				return c < 0;
+		} else if (field == SUBJECT) {
+			if (int c = i1.subject.compare(i2.subject); c != 0)
+				return c < 0;
+		} else if (int v1 = numeric(p1, field), v2 = numeric(p2, field); v1 != v2) {
+			return v1 < v2;
+		}
+	}
+	return false;
+}
+
+
+void Storage::append_field(std::pmr::string &row, const SchedulePosition &pos, Field field) const
+{
+	const ScheduleItem &item = cell(pos);
+	if (field == TEACHER)
+		row += item.teacher;
+	else if (field == SUBJECT)
+		row += item.subject;
+	else
+		append_int(row, numeric(pos, field));
+	row += "; ";
+}
+
+
+size_t Storage::field_width(const SchedulePosition &pos, Field field) const
+{
+	const ScheduleItem &item = cell(pos);
+	if (field == TEACHER)
+		return item.teacher.size() + 2;
+	if (field == SUBJECT)
+		return item.subject.size() + 2;
+	return 11 + 2; // int со знаком
+}
+
+
+/* Индекс используется, если хотя бы одно строковое поле задано точно. */
+AccessPath Storage::choose_path(const ConditionalQuery &query)
+{
+	for (const auto &cond : query.conditions()) {
+		if (cond.field == TEACHER && cond.relation == EQUAL)
+			return TEACHER_INDEX;
+		if (cond.field == SUBJECT && cond.relation == EQUAL)
+			return SUBJECT_INDEX;
+	}
+	return FULL_SCAN;
+}
+
+
+std::pair<int, int> Storage::days(const ConditionalQuery &query)
+{
+	for (const auto &cond : query.conditions())
+		if (cond.field == DAY)
+			return cond.get_range();
+	return {1, NUM_OF_DAYS};
+}
+
+
+size_t Storage::estimate(const ConditionalQuery &query, AccessPath path) const
+{
+	std::pair<int, int> room = {0, NUM_OF_ROOMS}, day = {1, NUM_OF_DAYS}, period = {1, NUM_OF_PERIODS};
+	const std::string *name = nullptr;
+	for (const auto &cond : query.conditions()) {
+		if ((path == TEACHER_INDEX && cond.field == TEACHER) ||
+			(path == SUBJECT_INDEX && cond.field == SUBJECT))
+			name = &std::get<std::string>(cond.value);
+		else if (cond.field == ROOM)
+			room = cond.get_range();
+		else if (cond.field == DAY)
+			day = cond.get_range();
+		else if (cond.field == PERIOD)
+			period = cond.get_range();
+	}
+	auto width = [](std::pair<int, int> range) { return size_t(std::max(0, range.second - range.first + 1)); };
+	if (name == nullptr)
+		return width(room) * width(day) * width(period);
+	size_t listed = 0;
+	for (int d = day.first; d <= day.second; ++d) {
+		const DayPage::NameSchedule &index = (path == TEACHER_INDEX ? this->day(d).teachers : this->day(d).subjects);
+		auto it = index.find(*name);
+		if (it != index.cend())
+			listed += it.val().size();
+	}
+	return listed;
+}
@@ -0,0 +1,213 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <string>
+#include <vector>
+#include "../Query/query.h"
+#include "../HashTable/HashTable.hpp"
+#include "filter.h"
+#include "predicate.h"
+#include "../Metrics/metrics.h"
+#include "../TaskStructures/task_structures.h"
+
+/* Один день расписания: его ячейки и индексы имён, в которых лежат позиции только этого дня. */
+struct DayPage
+{
+	using NameSchedule = HashTable< std::string, std::vector<PackedPosition> >;
+
+	ScheduleItem cells[NUM_OF_PERIODS][NUM_OF_ROOMS + 1];
+	/* Номера групп тех же ячеек подряд по аудиториям (-1 - ячейка пуста): по ним работает фильтр. */
+	int16_t groups[NUM_OF_PERIODS][ROOM_STRIDE];
+	size_t records = 0;	// количество занятых ячеек
+	NameSchedule teachers;
+	NameSchedule subjects;
+
+	DayPage() { std::fill(&groups[0][0], &groups[0][0] + NUM_OF_PERIODS * ROOM_STRIDE, -1); }
+};
+
+/*
+ * Память расписания по частям в байтах. Это оценка снизу: служебные данные распределителя
+ * памяти не учитываются, а страница, разделённая со снимком, считается один раз.
+ */
+struct StorageMemory
+{
+	struct Index {
+	  size_t names = 0;
+	  size_t buckets = 0;
+	  size_t table = 0;		// массивы цепочек и их узлы
+	  size_t strings = 0;	// имена, не поместившиеся во внутренний буфер std::string
+	  size_t positions = 0;	// позиций в списках
+	  size_t capacity = 0;	// места под позиции в списках
+
+	  size_t bytes() const { return table + strings + capacity * sizeof(PackedPosition); }
+	};
+	size_t cells = 0;			// матрицы ячеек и номеров групп
+	size_t strings = 0;			// строки занятых ячеек вне буфера std::string
+	size_t idle_strings = 0;	// строки, оставшиеся в освобождённых ячейках
+	Index teachers;
+	Index subjects;
+
+	size_t bytes() const { return cells + strings + idle_strings + teachers.bytes() + subjects.bytes(); }
+};
+
+/* Дописывает к строке десятичную запись числа. */
+void append_int(std::pmr::string &str, int number);
+
+/*
+ * Расписание, разбитое на страницы-дни с копированием при записи. Копия объекта - это снимок:
+ * она разделяет страницы с оригиналом, а писатель перед изменением страницы, которую держит
+ * ещё кто-то, заменяет её своей копией. Поэтому снимок не меняется и читается из другого потока
+ * без блокировок, а старая версия страницы освобождается вместе с последним снимком, который на
+ * неё ссылается. Разные дни можно изменять в разных потоках одновременно, но каждый день - только
+ * в одном; снимки снимаются, пока никто ничего не изменяет.
+ */
+class Storage
+{
+  private:
+	std::array<std::shared_ptr<DayPage>, NUM_OF_DAYS> _days;
+
+	static void name_remove(DayPage::NameSchedule &ns, const std::string &name, const SchedulePosition &pos);
+	/* Не держит ли страницу кто-то ещё; если нет, её можно менять на месте. */
+	static bool sole_owner(const std::shared_ptr<DayPage> &page);
+	/* Страница дня, которую можно менять: если её держит снимок, она сначала копируется. */
+	DayPage& writable(int day);
+	/* Освобождает все ячейки дня за время, пропорциональное числу занятых. */
+	void clear_day(int day);
+	/* Перебор по уже разобранным условиям, в которых ровно Names условий на имена. */
+	template <int Names, class Visitor>
+	size_t scan(const Predicate &pred, Visitor &visit) const;
+
+  public:
+	Storage();
+
+	/* Занимает ячейку записью в обход проверок на накладки (прежнее содержимое ячейки удаляется). */
+	void put(const SchedulePosition &pos, const Record &record);
+	void erase(const SchedulePosition &pos);
+	/*
+	 * Освобождает занятые ячейки positions (без повторов) разом: день, из которого удаляется всё, очищается
+	 * целиком, а в остальных списки индексов просеиваются за один проход вместо поиска в них
+	 * каждой позиции. Выгодно, когда удаляется заметная доля записей дня.
+	 */
+	void erase_all(std::span<const PackedPosition> positions);
+	/* Освобождает всё расписание. */
+	void truncate();
+
+	size_t records() const;
+	const DayPage& day(int day) const { return *_days[day - 1]; }
+	const ScheduleItem& cell(const SchedulePosition &pos) const {
+		return _days[pos.timecode / NUM_OF_PERIODS]->cells[pos.timecode % NUM_OF_PERIODS][pos.room];
+	}
+	/* Сколько страниц сейчас разделено со снимками. */
+	size_t shared_pages() const;
+	StorageMemory memory() const;
+	/*
+	 * Возвращает лишнюю память: списки позиций ужимаются до их длины, таблицы имён
+	 * перестраиваются под число имён, строки освобождённых ячеек удаляются. Страницы, которые
+	 * держат снимки, не трогаются (их пришлось бы копировать); возвращает число ужатых страниц.
+	 */
+	size_t compact();
+
+	Record get_record(const SchedulePosition &pos) const;
+	/* Значение числового поля (аудитория, день, пара, группа) записи в позиции pos. */
+	int numeric(const SchedulePosition &pos, Field field) const;
+	bool less(const SchedulePosition &p1, const SchedulePosition &p2, const std::vector<Field> &by) const;
+	/* Дописывает к строке ответа значение поля и разделитель "; ". */
+	void append_field(std::pmr::string &row, const SchedulePosition &pos, Field field) const;
+	/* Сколько символов самое большее допишет append_field. */
+	size_t field_width(const SchedulePosition &pos, Field field) const;
+
+	static AccessPath choose_path(const ConditionalQuery &query);
+	/* Дни, которыми ограничивает поиск условие на день (все, если его нет). */
+	static std::pair<int, int> days(const ConditionalQuery &query);
+	/*
+	 * Перебирает подходящие под запрос позиции, пока visit возвращает true; возвращает число проверенных.
+	 * Перебор можно дополнительно ограничить отрезком времени only_times (timecode), чтобы разные
+	 * блоки перебирали разные потоки; такой частичный перебор в метриках поиском не считается.
+	 */
+	template <class Visitor>
+	size_t scan(const ConditionalQuery &query, AccessPath path, Visitor visit,
+				std::pair<int, int> only_times = {0, NUM_OF_DAYS * NUM_OF_PERIODS - 1}) const;
+	/* Сколько ячеек предстоит проверить: длины списков в индексах или объём диапазона перебора. */
+	size_t estimate(const ConditionalQuery &query, AccessPath path) const;
+};
+
+
+/*
+ * Условия разбираются один раз на весь перебор, а число условий на имена становится параметром
+ * шаблона: проверка ячейки не ветвится ни по видам условий, ни по их количеству.
+ */
+template <class Visitor>
+size_t Storage::scan(const ConditionalQuery &query, AccessPath path, Visitor visit, std::pair<int, int> only_times) const
+{
+	Predicate pred(query, path);
+	pred.restrict(only_times.first, only_times.second);
+	size_t scanned;
+	if (pred.num_names == 0)
+		scanned = scan<0>(pred, visit);
+	else if (pred.num_names == 1)
+		scanned = scan<1>(pred, visit);
+	else
+		scanned = scan<2>(pred, visit);
+
+	MetricsShard &metrics = Metrics::local();
+	metrics.rows_scanned.add(scanned);
+	if (only_times.first == 0 && only_times.second == NUM_OF_DAYS * NUM_OF_PERIODS - 1)
+		metrics.lookups[path].add();
+	return scanned;
+}
+
+
+/*
+ * Перебор ячеек идёт по строкам (день и пара): занятость и условие на группу проверяются сразу для
+ * всех аудиторий строки векторным фильтром, аудитория, день и пара заданы границами перебора, и
+ * для отобранных ячеек остаётся проверить только имена.
+ */
+template <int Names, class Visitor>
+size_t Storage::scan(const Predicate &pred, Visitor &visit) const
+{
+	size_t scanned = 0;
+	for (int d = 1; d <= NUM_OF_DAYS; ++d) {
+		uint64_t day_times = (pred.times >> Time(d, 1)) & ((uint64_t(1) << NUM_OF_PERIODS) - 1);
+		if (day_times == 0)
+			continue;
+		const DayPage &page = *_days[d - 1];
+		if (pred.key != nullptr) {
+			const DayPage::NameSchedule &index = (pred.path == TEACHER_INDEX ? page.teachers : page.subjects);
+			auto it = index.find(*pred.key);
+			if (it == index.cend())
+				continue;
+			for (SchedulePosition pos : it.val()) {
+				++scanned;
+				const ScheduleItem &item = page.cells[pos.timecode % NUM_OF_PERIODS][pos.room];
+				if (pred.indexed_match<Names>(pos, item) && !visit(pos))
+					return scanned;
+			}
+			continue;
+		}
+		for (uint64_t periods = day_times; periods != 0; periods &= periods - 1) {
+			int p = std::countr_zero(periods);
+			uint64_t mask[ROOM_WORDS] = {};
+			select_groups(page.groups[p], pred.room.first, pred.room.second, pred.group.first, pred.group.second, mask);
+			for (int w = pred.room.first / 64; w <= pred.room.second / 64; ++w) {
+				for (uint64_t bits = mask[w]; bits != 0; bits &= bits - 1) {
+					SchedulePosition pos;
+					pos.timecode = Time(d, p + 1);
+					pos.room = w * 64 + std::countr_zero(bits);
+					if (pred.names_match<Names>(page.cells[p][pos.room]) && !visit(pos))
+						return scanned + pos.room - pred.room.first + 1;
+				}
+			}
+			scanned += pred.room.second - pred.room.first + 1;
+		}
+	}
+	return scanned;
+}
+
+#endif // STORAGE_H
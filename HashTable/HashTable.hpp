@@ -5,6 +5,9 @@
 
 #include <functional>
 #include <forward_list>
+#include <utility>
+#include <iterator>
+#include <algorithm>
 
 #include "HashTableExc.h"
 
@@ -34,8 +37,30 @@ private:
 
 	bool empty() const { return _size == 0; }
 	size_t size() const { return _size; }
+	size_t buckets() const { return _hashes; }
+	/* Длина самой длинной цепочки и количество непустых цепочек. */
+	std::pair<size_t, size_t> chains() const;
+	/* Вызывает f(key, value) для каждого элемента. */
+	template <class F>
+	void for_each(F f) const {
+		for (size_t i = 0; i < _hashes; ++i)
+			for (const auto &[key, value] : _table[i])
+				f(key, value);
+	}
+	template <class F>
+	void for_each(F f) {
+		for (size_t i = 0; i < _hashes; ++i)
+			for (auto &[key, value] : _table[i])
+				f(std::as_const(key), value);
+	}
+	/* Память под массив цепочек и их узлы (без памяти, на которую ссылаются сами элементы). */
+	size_t memory() const {
+		return _hashes * sizeof(HashClass) + _size * (sizeof(typename HashClass::value_type) + sizeof(void*));
+	}
 
 	void swap(HashTable &other);
+	/* Перераспределяет элементы по hashes цепочкам; узлы переносятся без копирования. */
+	void rehash(size_t hashes);
 
 	Iterator begin() { return Iterator(this, 0, _table[0].begin()); }
 	ConstIterator cbegin() const { return ConstIterator(this, 0, _table[0].cbegin()); }
@@ -49,6 +74,9 @@ private:
 	Iterator find(const Key &key);
 	ConstIterator find(const Key &key) const;
 	size_t erase(const Key &key);
+	/* Удаляет за один проход элементы, для которых pred(key, value) истинно; pred может менять value. */
+	template <class Pred>
+	size_t erase_if(Pred pred);
 	size_t count(const Key &key) const { return (find(key) == cend()) ? 0 : 1; }
 };
 
@@ -161,7 +189,7 @@ _size(other._size), _hashes(other._hashes), _table(new HashClass[_hashes])
 
 template <class Key, class T, class Hash>
 void HashTable<Key, T, Hash>::clear() {
-	for (int i = 0; i < _hashes; ++i)
+	for (size_t i = 0; i < _hashes; ++i)
 		_table[i].clear();
 	_size = 0;
 }
@@ -174,6 +202,22 @@ void HashTable<Key, T, Hash>::swap(HashTable &other)
 	std::swap(_table, other._table);
 }
 
+template <class Key, class T, class Hash>
+void HashTable<Key, T, Hash>::rehash(size_t hashes)
+{
+	HashClass *old = _table;
+	size_t old_hashes = _hashes;
+	_table = new HashClass[hashes];
+	_hashes = hashes;
+	for (size_t i = 0; i < old_hashes; ++i) {
+		while (!old[i].empty()) {
+			size_t h = get_hash(old[i].front().first);
+			_table[h].splice_after(_table[h].before_begin(), old[i], old[i].before_begin());
+		}
+	}
+	delete[] old;
+}
+
 template <class Key, class T, class Hash>
 T& HashTable<Key, T, Hash>::operator[](const Key &key)
 {
@@ -223,6 +267,18 @@ HashTable<Key, T, Hash>::find(const Key &key) const
 	return cend();
 }
 
+template<class Key, class T, class Hash>
+std::pair<size_t, size_t> HashTable<Key, T, Hash>::chains() const
+{
+	size_t longest = 0, used = 0;
+	for (size_t i = 0; i < _hashes; ++i) {
+		size_t len = std::distance(_table[i].cbegin(), _table[i].cend());
+		longest = std::max(longest, len);
+		used += (len > 0);
+	}
+	return {longest, used};
+}
+
 template<class Key, class T, class Hash>
 size_t HashTable<Key, T, Hash>::erase(const Key &key)
 {
@@ -241,4 +297,24 @@ size_t HashTable<Key, T, Hash>::erase(const Key &key)
 	return 0;
 }
 
+template <class Key, class T, class Hash>
+template <class Pred>
+size_t HashTable<Key, T, Hash>::erase_if(Pred pred)
+{
+	size_t erased = 0;
+	for (size_t h = 0; h < _hashes; ++h) {
+		auto prev_it = _table[h].before_begin();
+		for (auto cur_it = _table[h].begin(); cur_it != _table[h].end(); ) {
+			if (pred(cur_it->first, cur_it->second)) {
+				cur_it = _table[h].erase_after(prev_it);
+				++erased;
+			} else {
+				prev_it = cur_it++;
+			}
+		}
+	}
+	_size -= erased;
+	return erased;
+}
+
 #endif // HASH_TABLE_HPP
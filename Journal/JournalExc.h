@@ -0,0 +1,28 @@
+#ifndef JOURNAL_EXC_H
+#define JOURNAL_EXC_H
+
+#include <exception>
+
+class JournalExc : public std::exception {
+	const char *msg;
+  public:
+	JournalExc(const char *msg) : msg(msg) {}
+	virtual const char *what() const noexcept override { return msg; }
+};
+
+class JournalExcFile : public JournalExc {
+  public:
+	JournalExcFile(const char *msg) : JournalExc(msg) {}
+};
+
+class JournalExcWrite : public JournalExc {
+  public:
+	JournalExcWrite(const char *msg) : JournalExc(msg) {}
+};
+
+class JournalExcReplication : public JournalExc {
+  public:
+	JournalExcReplication(const char *msg) : JournalExc(msg) {}
+};
+
+#endif // JOURNAL_EXC_H
@@ -0,0 +1,123 @@
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <iostream>
+#include "checkpoint.h"
+
+#define CHECKPOINT_POLL_MS 100	// как часто проверять, не завершилась ли запись снимка
+
+/* -----------------------------------------PRIVATE METHODS-------------------------------------- */
+
+bool Checkpoint::due() const
+{
+	if (_journal.records() == 0)
+		return false;
+	if (_writes > 0 && _journal.records() >= _writes)
+		return true;
+	return _interval.count() > 0 && Clock::now() - _started >= _interval;
+}
+
+/* Выполняется в дочернем процессе. */
+void Checkpoint::write_snapshot() const
+{
+	int code = EXIT_SUCCESS;
+	try {
+		_database.to_file(_filename);
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - _started);
+		struct stat st;
+		long long size = (stat(_filename.c_str(), &st) == 0) ? st.st_size : -1;
+		std::cout << "Checkpoint: " << size << " bytes written in " << ms.count() << " ms" << std::endl;
+	} catch (const std::exception &e) {
+		std::cout << e.what() << std::endl;
+		code = EXIT_FAILURE;
+	}
+	_exit(code);
+}
+
+void Checkpoint::finish(int status)
+{
+	_child = 0;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		std::cout << "Checkpoint failed, the rotated journal is kept" << std::endl;
+		return;
+	}
+	try {
+		_journal.drop_rotated();
+	} catch (const JournalExc &e) {
+		std::cout << e.what() << std::endl;
+	}
+}
+
+/* ----------------------------------------PUBLIC METHODS---------------------------------------- */
+
+Checkpoint::Checkpoint(const Database &database, Journal &journal, const std::string &filename,
+					   int interval_sec, size_t writes) :
+	_database(database), _journal(journal), _filename(filename), _interval(interval_sec),
+	_writes(writes), _child(0), _started(Clock::now()) {}
+
+void Checkpoint::start()
+{
+	if (running() || !due())
+		return;
+	try {
+		_journal.rotate();
+	} catch (const JournalExc &e) {
+		std::cout << e.what() << std::endl;
+		return;
+	}
+	std::cout.flush();
+	_started = Clock::now();
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("Server cannot fork for checkpoint");
+		return;
+	}
+	if (pid == 0)
+		write_snapshot();
+	_child = pid;
+}
+
+void Checkpoint::tick()
+{
+	if (running()) {
+		int status;
+		pid_t pid = waitpid(_child, &status, WNOHANG);
+		if (pid == 0)
+			return;
+		if (pid < 0) {
+			perror("Server cannot wait for checkpoint");
+			_child = 0;
+			return;
+		}
+		finish(status);
+	}
+	start();
+}
+
+void Checkpoint::wait()
+{
+	if (!running())
+		return;
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(_child, &status, 0)) < 0 && errno == EINTR)
+		continue;
+	if (pid < 0) {
+		perror("Server cannot wait for checkpoint");
+		_child = 0;
+		return;
+	}
+	finish(status);
+}
+
+int Checkpoint::timeout() const
+{
+	if (running())
+		return CHECKPOINT_POLL_MS;
+	if (_interval.count() == 0 || _journal.records() == 0)
+		return -1;
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+		_started + _interval - Clock::now());
+	return left.count() > 0 ? left.count() : 0;
+}
@@ -0,0 +1,50 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <chrono>
+#include <sys/types.h>
+#include "journal.h"
+#include "../Database/database.h"
+
+/*
+ * Фоновые контрольные точки. Снимок пишет дочерний процесс, получивший при fork() копию памяти
+ * сервера на момент запуска (страницы копируются ядром лишь при записи), поэтому родитель
+ * продолжает обслуживать клиентов. Журнал в этот момент ротируется: всё, что было до fork(),
+ * попадает в снимок, всё после - в новый журнал.
+ */
+class Checkpoint
+{
+  private:
+	using Clock = std::chrono::steady_clock;
+
+	const Database &_database;
+	Journal &_journal;
+	std::string _filename;
+	std::chrono::seconds _interval;	// не реже чем раз в столько секунд (0 - не ограничено)
+	size_t _writes;					// не реже чем раз в столько записей журнала (0 - не ограничено)
+	pid_t _child;
+	Clock::time_point _started;		// момент запуска текущей (или последней) контрольной точки
+
+	bool due() const;
+	[[noreturn]] void write_snapshot() const;
+	void finish(int status);
+
+  public:
+	Checkpoint(const Database &database, Journal &journal, const std::string &filename,
+			   int interval_sec, size_t writes);
+	Checkpoint(const Checkpoint &) = delete;
+	Checkpoint& operator=(const Checkpoint &) = delete;
+
+	bool running() const { return _child > 0; }
+	/* Запускает запись снимка, если пришло время и предыдущая уже завершилась. */
+	void start();
+	/* Подбирает завершившийся дочерний процесс и при необходимости запускает новый. */
+	void tick();
+	/* Дожидается завершения текущей записи снимка. */
+	void wait();
+	/* Время в мс до следующей проверки (-1, если ждать нечего). */
+	int timeout() const;
+};
+
+#endif // CHECKPOINT_H
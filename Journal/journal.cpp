@@ -0,0 +1,195 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstdio>
+#include <charconv>
+#include "journal.h"
+
+/* -----------------------------------------PRIVATE METHODS-------------------------------------- */
+
+void Journal::Batch::append(char op, std::string_view teacher, std::string_view subject, int room, Time time, int group)
+{
+	_text += op;
+	_text += ' ';
+	_text += teacher;
+	_text += "; ";
+	_text += subject;
+	_text += "; ";
+	append_int(room);
+	_text += "; ";
+	append_int(time.day);
+	_text += "; ";
+	append_int(time.period);
+	_text += "; ";
+	append_int(group);
+	_text += ";\n";
+	++_records;
+}
+
+void Journal::Batch::append_int(int number)
+{
+	char buf[16];
+	auto res = std::to_chars(buf, buf + sizeof(buf), number);
+	_text.append(buf, res.ptr);
+}
+
+void Journal::write_all(const char *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t written = write(_fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			throw JournalExcWrite("Journal: cannot write to the file!");
+		}
+		data += written;
+		len -= written;
+	}
+}
+
+/* Отрезает строку, оборванную при аварийном завершении, чтобы новые записи не склеились с ней. */
+void Journal::repair_tail()
+{
+	off_t size = lseek(_fd, 0, SEEK_END);
+	if (size <= 0)
+		return;
+	off_t end = size;
+	char c;
+	while (end > 0) {
+		if (pread(_fd, &c, 1, end - 1) != 1)
+			throw JournalExcFile("Journal: cannot read the file!");
+		if (c == '\n')
+			break;
+		--end;
+	}
+	if (end != size && ftruncate(_fd, end) < 0)
+		throw JournalExcFile("Journal: cannot truncate the file!");
+}
+
+/* ----------------------------------------PUBLIC METHODS---------------------------------------- */
+
+Journal::Journal(const std::string &filename, SyncPolicy policy, int sync_interval_ms) :
+	_filename(filename), _policy(policy), _sync_interval(sync_interval_ms),
+	_last_sync(Clock::now()), _unsynced(false), _records(0)
+{
+	_fd = open(_filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (_fd < 0)
+		throw JournalExcFile("Journal: cannot open the file!");
+	try {
+		repair_tail();
+	} catch (...) {
+		close(_fd);
+		throw;
+	}
+}
+
+Journal::~Journal()
+{
+	try {
+		commit();
+		if (_unsynced)
+			fsync(_fd);
+	} catch (const JournalExc &) {
+		// в деструкторе сообщить об ошибке уже некому
+	}
+	close(_fd);
+}
+
+void Journal::append(Batch &batch)
+{
+	_buffer._text += batch._text;
+	_records += batch._records;
+	batch.clear();
+}
+
+void Journal::commit()
+{
+	if (_buffer.empty())
+		return;
+	write_all(_buffer._text.data(), _buffer._text.size());
+	_buffer.clear();
+	_unsynced = true;
+	sync();
+}
+
+void Journal::sync()
+{
+	if (!_unsynced || _policy == SYNC_NEVER)
+		return;
+	Clock::time_point now = Clock::now();
+	if (_policy == SYNC_PERIODIC && now - _last_sync < _sync_interval)
+		return;
+	if (fsync(_fd) < 0)
+		throw JournalExcWrite("Journal: cannot sync the file!");
+	_last_sync = now;
+	_unsynced = false;
+}
+
+int Journal::timeout() const
+{
+	if (!_unsynced || _policy != SYNC_PERIODIC)
+		return -1;
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+		_last_sync + _sync_interval - Clock::now());
+	return left.count() > 0 ? left.count() : 0;
+}
+
+void Journal::reset()
+{
+	_buffer.clear();
+	if (ftruncate(_fd, 0) < 0)
+		throw JournalExcFile("Journal: cannot truncate the file!");
+	if (fsync(_fd) < 0)
+		throw JournalExcWrite("Journal: cannot sync the file!");
+	_unsynced = false;
+	_last_sync = Clock::now();
+	_records = 0;
+}
+
+void Journal::rotate()
+{
+	commit();
+	if (_unsynced && _policy != SYNC_NEVER && fsync(_fd) < 0)
+		throw JournalExcWrite("Journal: cannot sync the file!");
+
+	std::string old = rotated_filename();
+	if (access(old.c_str(), F_OK) == 0) {
+		/* Прошлый снимок так и не был записан, и отложенный журнал всё ещё нужен целиком. */
+		int fd = open(old.c_str(), O_WRONLY | O_APPEND);
+		if (fd < 0)
+			throw JournalExcFile("Journal: cannot open the rotated file!");
+		char chunk[1 << 16];
+		off_t offset = 0;
+		ssize_t n;
+		while ((n = pread(_fd, chunk, sizeof(chunk), offset)) > 0) {
+			if (write(fd, chunk, n) != n) {
+				close(fd);
+				throw JournalExcWrite("Journal: cannot write the rotated file!");
+			}
+			offset += n;
+		}
+		if (n < 0 || fsync(fd) < 0) {
+			close(fd);
+			throw JournalExcWrite("Journal: cannot write the rotated file!");
+		}
+		close(fd);
+		if (ftruncate(_fd, 0) < 0)
+			throw JournalExcFile("Journal: cannot truncate the file!");
+	} else {
+		if (std::rename(_filename.c_str(), old.c_str()) < 0)
+			throw JournalExcFile("Journal: cannot rotate the file!");
+		close(_fd);
+		_fd = open(_filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+		if (_fd < 0)
+			throw JournalExcFile("Journal: cannot open the file!");
+	}
+	_unsynced = false;
+	_records = 0;
+}
+
+void Journal::drop_rotated()
+{
+	if (unlink(rotated_filename().c_str()) < 0 && errno != ENOENT)
+		throw JournalExcFile("Journal: cannot remove the rotated file!");
+}
@@ -0,0 +1,119 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <string_view>
+#include <chrono>
+#include "JournalExc.h"
+#include "../TaskStructures/task_structures.h"
+
+/*
+ * Журнал упреждающей записи (write-ahead log).
+ * Хранит логические операции над расписанием в формате файла данных, каждая строка
+ * предваряется знаком операции:
+ *   + teacher; subject; room; day; period; group;	- ячейка занята указанной записью
+ *   - teacher; subject; room; day; period; group;	- ячейка освобождена
+ *   !												- расписание очищено целиком
+ * Операции копятся в буфере и сбрасываются в файл одной последовательной записью на группу.
+ */
+class Journal
+{
+  public:
+	/*
+	 * Записи, накопленные отдельно от журнала, например в потоке, изменяющем один день, и
+	 * передаваемые в него целиком методом append().
+	 */
+	class Batch
+	{
+	  private:
+		std::string _text;
+		size_t _records = 0;
+
+		void append(char op, std::string_view teacher, std::string_view subject, int room, Time time, int group);
+		void append_int(int number);
+
+		friend class Journal;
+
+	  public:
+		void log_insert(const Record &record) {
+			append('+', record.teacher, record.subject, record.room, record.time, record.group);
+		}
+		void log_remove(const ScheduleItem &item, const SchedulePosition &pos) {
+			append('-', item.teacher, item.subject, pos.room, Time(pos.timecode), item.group);
+		}
+		void log_truncate() {
+			_text += "!\n";
+			++_records;
+		}
+		bool empty() const { return _text.empty(); }
+		void clear() { _text.clear(); _records = 0; }
+		const std::string& text() const { return _text; }
+	};
+
+	typedef enum
+	{
+		SYNC_ALWAYS,	// fsync после каждой группы
+		SYNC_PERIODIC,	// fsync не чаще одного раза за интервал
+		SYNC_NEVER		// сброс на диск остаётся на усмотрение ОС
+	} SyncPolicy;
+
+  private:
+	using Clock = std::chrono::steady_clock;
+
+	int _fd;
+	std::string _filename;
+	Batch _buffer;				// записи текущей группы, ещё не переданные в файл
+	SyncPolicy _policy;
+	std::chrono::milliseconds _sync_interval;
+	Clock::time_point _last_sync;
+	bool _unsynced;				// в файле есть данные, не сброшенные на диск
+	size_t _records;			// количество записей с момента последней ротации
+
+	void write_all(const char *data, size_t len);
+	void repair_tail();
+
+  public:
+	Journal(const std::string &filename, SyncPolicy policy = SYNC_ALWAYS, int sync_interval_ms = 1000);
+	Journal(const Journal &) = delete;
+	Journal& operator=(const Journal &) = delete;
+	~Journal();
+
+	void log_insert(const Record &record) {
+		_buffer.log_insert(record);
+		++_records;
+	}
+	void log_remove(const ScheduleItem &item, const SchedulePosition &pos) {
+		_buffer.log_remove(item, pos);
+		++_records;
+	}
+	void log_truncate() {
+		_buffer.log_truncate();
+		++_records;
+	}
+	/* Добавляет записи batch к текущей группе и очищает batch. */
+	void append(Batch &batch);
+	bool pending() const { return !_buffer.empty(); }
+	/* Текст текущей группы, ещё не записанной в файл. */
+	const std::string& group() const { return _buffer.text(); }
+	size_t records() const { return _records; }
+	const std::string& filename() const { return _filename; }
+	std::string rotated_filename() const { return _filename + ".old"; }
+
+	/* Записывает накопленную группу в файл и при необходимости сбрасывает её на диск. */
+	void commit();
+	/* Сбрасывает на диск всё записанное, если политика это предполагает. */
+	void sync();
+	/* Время в мс до очередного обязательного fsync (-1, если ждать нечего). */
+	int timeout() const;
+	/* Очищает журнал после того, как его содержимое попало в снимок базы. */
+	void reset();
+	/*
+	 * Откладывает текущее содержимое в rotated_filename() и начинает журнал заново.
+	 * Вызывается в момент, на который делается снимок: всё отложенное в него попадёт.
+	 */
+	void rotate();
+	/* Удаляет отложенную часть журнала, когда снимок благополучно записан. */
+	void drop_rotated();
+};
+
+#endif // JOURNAL_H
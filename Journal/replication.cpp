@@ -0,0 +1,301 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "replication.h"
+
+#define REPLICATION_QUEUE 4	// очередь подключений реплик
+
+/* Адрес Unix-сокета; false, если путь не помещается в sun_path. */
+static bool unix_address(const std::string &path, sockaddr_un &addr)
+{
+	if (path.size() >= sizeof(addr.sun_path))
+		return false;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+	return true;
+}
+
+/* -----------------------------------------PRIVATE METHODS-------------------------------------- */
+
+void LogShipper::loop()
+{
+	std::vector<Follower> followers;
+	std::vector<pollfd> fds;
+	auto last_sent = Clock::now();
+	auto drop = [this, &followers](size_t i) {
+		close(followers[i].fd);
+		followers.erase(followers.begin() + i);
+		--_followers;
+	};
+
+	while (true) {
+		fds.assign(1, pollfd{_wake[0], POLLIN, 0});
+		for (const Follower &f : followers)
+			fds.push_back({f.fd, short(POLLIN | (f.sent < f.out.size() ? POLLOUT : 0)), 0});
+		if (poll(fds.data(), fds.size(), REPLICATION_HEARTBEAT_MS) < 0 && errno != EINTR)
+			perror("Replication poll failure");
+
+		/* Реплики ничего не присылают: данные или конец потока означают, что она отключилась. */
+		for (size_t i = followers.size(); i-- > 0; ) {
+			short revents = fds[i + 1].revents;
+			char buf[64];
+			if ((revents & (POLLERR | POLLHUP | POLLNVAL)) ||
+				((revents & POLLIN) && recv(followers[i].fd, buf, sizeof(buf), 0) <= 0))
+				drop(i);
+		}
+
+		std::vector<Event> events;
+		if (fds[0].revents & POLLIN) {
+			char buf[64];
+			while (read(_wake[0], buf, sizeof(buf)) > 0)
+				continue;
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_stop)
+				break;
+			events.swap(_events);
+		}
+		for (Event &event : events) {
+			if (event.snapshot) {
+				followers.push_back({event.fd, {}});
+				serialize(*event.snapshot, followers.back().out);
+				continue;
+			}
+			for (Follower &f : followers)
+				f.out += event.group;
+			last_sent = Clock::now();
+		}
+		if (Clock::now() - last_sent >= std::chrono::milliseconds(REPLICATION_HEARTBEAT_MS)) {
+			for (Follower &f : followers)
+				if (f.sent == f.out.size())
+					f.out += '\n';
+			last_sent = Clock::now();
+		}
+
+		for (size_t i = followers.size(); i-- > 0; ) {
+			if (!flush(followers[i])) {
+				std::cout << "Replica disconnected" << std::endl;
+				drop(i);
+			}
+		}
+	}
+
+	for (const Follower &f : followers)
+		close(f.fd);
+	_followers = 0;
+}
+
+void LogShipper::serialize(const Storage &snapshot, std::string &out)
+{
+	Journal::Batch batch;
+	batch.log_truncate();
+	for (int t = 0; t < NUM_OF_DAYS * NUM_OF_PERIODS; ++t) {
+		for (int room = 0; room <= NUM_OF_ROOMS; ++room) {
+			SchedulePosition pos(Time(t), room);
+			if (!snapshot.cell(pos).empty())
+				batch.log_insert(snapshot.get_record(pos));
+		}
+	}
+	out += batch.text();
+	out += "=\n";
+}
+
+bool LogShipper::flush(Follower &follower)
+{
+	while (follower.sent < follower.out.size()) {
+		ssize_t written = send(follower.fd, follower.out.data() + follower.sent,
+							   follower.out.size() - follower.sent, MSG_NOSIGNAL);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return false;
+			break;
+		}
+		follower.sent += written;
+	}
+	if (follower.sent == follower.out.size()) {
+		follower.out.clear();
+		follower.sent = 0;
+	} else if (follower.sent > follower.out.size() / 2) {
+		follower.out.erase(0, follower.sent);
+		follower.sent = 0;
+	}
+	return follower.out.size() - follower.sent <= REPLICATION_MAX_BACKLOG;
+}
+
+void LogShipper::post(Event event)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_events.push_back(std::move(event));
+	}
+	char byte = 0;
+	if (write(_wake[1], &byte, 1) < 0 && errno != EAGAIN)
+		perror("Server cannot wake the replication thread");
+}
+
+/* ----------------------------------------PUBLIC METHODS---------------------------------------- */
+
+LogShipper::LogShipper(const std::string &path) : _path(path)
+{
+	sockaddr_un addr;
+	if (!unix_address(_path, addr))
+		throw JournalExcReplication("Replication: the socket path is too long!");
+	unlink(_path.c_str()); // сокет, оставшийся от прошлого запуска
+	_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (_listen_fd < 0)
+		throw JournalExcReplication("Replication: cannot create a socket!");
+	if (bind(_listen_fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(_listen_fd, REPLICATION_QUEUE) < 0) {
+		close(_listen_fd);
+		throw JournalExcReplication("Replication: cannot listen on the socket!");
+	}
+	if (pipe2(_wake, O_NONBLOCK | O_CLOEXEC) < 0) {
+		close(_listen_fd);
+		unlink(_path.c_str());
+		throw JournalExcReplication("Replication: cannot create a pipe!");
+	}
+	_thread = std::thread(&LogShipper::loop, this);
+}
+
+LogShipper::~LogShipper()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	char byte = 0;
+	if (write(_wake[1], &byte, 1) < 0 && errno != EAGAIN)
+		perror("Server cannot wake the replication thread");
+	_thread.join();
+	for (const Event &event : _events)
+		if (event.snapshot)
+			close(event.fd);
+	close(_wake[0]);
+	close(_wake[1]);
+	close(_listen_fd);
+	unlink(_path.c_str());
+}
+
+void LogShipper::accept(Storage snapshot)
+{
+	int fd = accept4(_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		perror("Server cannot accept a replica");
+		return;
+	}
+	++_followers;
+	std::cout << "Replica connected" << std::endl;
+	post({fd, std::move(snapshot), {}});
+}
+
+void LogShipper::publish(std::string_view group)
+{
+	if (_followers == 0 || group.empty())
+		return;
+	post({-1, std::nullopt, std::string(group)});
+}
+
+
+/* -----------------------------------------PRIVATE METHODS-------------------------------------- */
+
+void LogFollower::disconnect()
+{
+	close(_fd);
+	_fd = -1;
+	_in.clear();
+	_caught_up = false;
+	_next_retry = Clock::now() + _retry;
+	std::cout << "Lost connection to the primary" << std::endl;
+}
+
+/* ----------------------------------------PUBLIC METHODS---------------------------------------- */
+
+LogFollower::LogFollower(Database &database, const std::string &path, int max_lag_ms, int retry_ms) :
+	_database(database), _path(path), _max_lag(max_lag_ms), _retry(retry_ms), _next_retry(Clock::now()) {}
+
+LogFollower::~LogFollower()
+{
+	if (_fd >= 0)
+		close(_fd);
+}
+
+void LogFollower::tick()
+{
+	if (_fd >= 0 || Clock::now() < _next_retry)
+		return;
+	_next_retry = Clock::now() + _retry;
+	sockaddr_un addr;
+	if (!unix_address(_path, addr))
+		return;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return;
+	if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+		close(fd);
+		return;
+	}
+	_fd = fd;
+	_last_heard = Clock::now();
+	std::cout << "Connected to the primary" << std::endl;
+}
+
+int LogFollower::timeout() const
+{
+	if (_fd >= 0)
+		return -1;
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(_next_retry - Clock::now());
+	return left.count() > 0 ? left.count() : 0;
+}
+
+void LogFollower::receive()
+{
+	if (_fd < 0)
+		return;
+	char buf[64 * 1024];
+	while (true) {
+		ssize_t got = recv(_fd, buf, sizeof(buf), 0);
+		if (got > 0) {
+			_in.append(buf, got);
+			continue;
+		}
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		disconnect(); // ведущий завершился
+		return;
+	}
+	_last_heard = Clock::now();
+
+	size_t start = 0;
+	try {
+		for (size_t end; (end = _in.find('\n', start)) != std::string::npos; start = end + 1) {
+			std::string_view line(_in.data() + start, end - start);
+			if (line.empty())
+				continue; // ведущий на связи, изменений нет
+			if (line == "=") {
+				_caught_up = true;
+				continue;
+			}
+			_database.apply(line);
+			++_applied;
+		}
+	} catch (const DatabaseExc &e) {
+		std::cout << e.what() << std::endl;
+		disconnect();
+		return;
+	}
+	_in.erase(0, start);
+}
+
+bool LogFollower::fresh() const
+{
+	return _fd >= 0 && _caught_up && Clock::now() - _last_heard <= _max_lag;
+}
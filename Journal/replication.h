@@ -0,0 +1,115 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include "journal.h"
+#include "../Database/database.h"
+
+#define REPLICATION_HEARTBEAT_MS 100				// пустая строка репликам, если изменений нет столько мс
+#define REPLICATION_MAX_BACKLOG (64 * 1024 * 1024)	// реплика, не принявшая столько байт, отключается
+
+/*
+ * Рассылка изменений репликам (ведущий сервер). Реплики подключаются к Unix-сокету и получают
+ * поток в формате журнала: сначала снимок базы (строка "!", затем "+" на каждую запись и строка
+ * "="), потом каждую группу изменений, уже записанную в журнал. Если изменений нет, раз в
+ * REPLICATION_HEARTBEAT_MS уходит пустая строка - по ней реплика судит, давно ли она на связи.
+ * Снимки сериализует и рассылает отдельный поток, так что клиентов ведущего реплики не задерживают;
+ * реплика, которая отстала больше чем на REPLICATION_MAX_BACKLOG байт, отключается и при
+ * переподключении догоняет ведущий по новому снимку.
+ */
+class LogShipper
+{
+  private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Follower {
+	  int fd;
+	  std::string out;	// ещё не отправленное
+	  size_t sent = 0;	// сколько байт из out уже отправлено
+	};
+	/* Новая реплика со снимком, с которого начнётся её поток, или очередная группа изменений. */
+	struct Event {
+	  int fd = -1;
+	  std::optional<Storage> snapshot;
+	  std::string group;
+	};
+
+	std::string _path;
+	int _listen_fd;
+	int _wake[2];						// будит поток рассылки, когда есть события
+	std::mutex _mutex;
+	std::vector<Event> _events;
+	bool _stop = false;
+	std::atomic<size_t> _followers{0};	// подключённых реплик, включая ещё не получивших снимок
+	std::thread _thread;
+
+	void loop();
+	static void serialize(const Storage &snapshot, std::string &out);
+	/* Отправляет, сколько получится, без ожидания; false - реплику пора отключить. */
+	static bool flush(Follower &follower);
+	void post(Event event);
+
+  public:
+	explicit LogShipper(const std::string &path);
+	LogShipper(const LogShipper &) = delete;
+	LogShipper& operator=(const LogShipper &) = delete;
+	~LogShipper();
+
+	/* Слушающий сокет: становится доступен для чтения, когда подключается реплика. */
+	int listen_fd() const { return _listen_fd; }
+	/* Принимает подключившуюся реплику; snapshot - состояние базы, с которого начнётся её поток. */
+	void accept(Storage snapshot);
+	/* Передаёт репликам группу изменений, уже записанную в журнал. */
+	void publish(std::string_view group);
+	size_t followers() const { return _followers; }
+};
+
+/*
+ * Реплика: получает поток изменений ведущего сервера и применяет его к своей базе. Реплика
+ * свежая, если снимок получен целиком и от ведущего что-то приходило не дольше max_lag_ms назад;
+ * потеряв соединение, она раз в retry_ms пытается подключиться снова.
+ */
+class LogFollower
+{
+  private:
+	using Clock = std::chrono::steady_clock;
+
+	Database &_database;
+	std::string _path;
+	std::chrono::milliseconds _max_lag;
+	std::chrono::milliseconds _retry;
+	int _fd = -1;
+	std::string _in;			// принятое, но ещё не разобранное до конца строки
+	bool _caught_up = false;	// снимок получен целиком
+	Clock::time_point _last_heard;
+	Clock::time_point _next_retry;
+	size_t _applied = 0;		// применённых изменений за всё время
+
+	void disconnect();
+
+  public:
+	LogFollower(Database &database, const std::string &path, int max_lag_ms, int retry_ms);
+	LogFollower(const LogFollower &) = delete;
+	LogFollower& operator=(const LogFollower &) = delete;
+	~LogFollower();
+
+	/* Сокет ведущего (-1, если соединения нет). */
+	int fd() const { return _fd; }
+	/* Подключается к ведущему, если соединения нет и пришло время новой попытки. */
+	void tick();
+	/* Время в мс до следующей попытки подключения (-1, если соединение есть). */
+	int timeout() const;
+	/* Применяет всё, что пришло от ведущего; при разрыве или ошибке в потоке отключается. */
+	void receive();
+	bool fresh() const;
+	size_t applied() const { return _applied; }
+};
+
+#endif // REPLICATION_H
@@ -0,0 +1,100 @@
+#include <bit>
+#include <cmath>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include "metrics.h"
+
+static const auto Started = std::chrono::steady_clock::now();
+
+/* Счётчики всех потоков: они переживают свои потоки, чтобы сумма не уменьшалась. */
+static std::mutex Shards_Mutex;
+static std::vector< std::unique_ptr<MetricsShard> > Shards;
+
+static constexpr uint64_t Sub_Count = 1 << LATENCY_SUB_BITS, Half_Count = Sub_Count / 2;
+
+static size_t latency_bucket(uint64_t ns)
+{
+	if (ns < Sub_Count)
+		return ns;
+	int shift = std::bit_width(ns) - LATENCY_SUB_BITS;
+	return Sub_Count + (shift - 1) * Half_Count + ((ns >> shift) - Half_Count);
+}
+
+/* Наибольшая задержка, попадающая в корзину. */
+static uint64_t latency_upper(size_t bucket)
+{
+	if (bucket < Sub_Count)
+		return bucket;
+	bucket -= Sub_Count;
+	int shift = bucket / Half_Count + 1;
+	uint64_t mantissa = bucket % Half_Count + Half_Count;
+	return ((mantissa + 1) << shift) - 1; // в последней корзине сдвиг даёт 0, и получается UINT64_MAX
+}
+
+MetricsShard& Metrics::local()
+{
+	thread_local MetricsShard *shard = nullptr;
+	if (shard == nullptr) {
+		std::lock_guard<std::mutex> lock(Shards_Mutex);
+		Shards.push_back(std::make_unique<MetricsShard>());
+		shard = Shards.back().get();
+	}
+	return *shard;
+}
+
+MetricsSnapshot Metrics::collect()
+{
+	MetricsSnapshot sum{};
+	std::lock_guard<std::mutex> lock(Shards_Mutex);
+	for (const auto &shard : Shards) {
+		for (int t = 0; t < NUM_OF_QUERY_TYPES; ++t) {
+			const MetricsShard::Command &from = shard->commands[t];
+			MetricsSnapshot::Command &to = sum.commands[t];
+			to.count += from.count.get();
+			to.errors += from.errors.get();
+			to.total_ns += from.total_ns.get();
+			to.max_ns = std::max(to.max_ns, from.max_ns.get());
+			for (int b = 0; b < LATENCY_BUCKETS; ++b)
+				to.latency[b] += from.latency[b].get();
+		}
+		sum.rows_scanned += shard->rows_scanned.get();
+		sum.rows_returned += shard->rows_returned.get();
+		for (int l = 0; l < NUM_OF_LOOKUPS; ++l)
+			sum.lookups[l] += shard->lookups[l].get();
+		sum.bytes_in += shard->bytes_in.get();
+		sum.bytes_out += shard->bytes_out.get();
+		sum.snapshot_reads += shard->snapshot_reads.get();
+		sum.pages_copied += shard->pages_copied.get();
+		sum.io_syscalls += shard->io_syscalls.get();
+	}
+	return sum;
+}
+
+std::chrono::steady_clock::time_point Metrics::started()
+{
+	return Started;
+}
+
+void Metrics::record_query(QueryType type, bool error, uint64_t ns)
+{
+	MetricsShard::Command &command = local().commands[type];
+	command.count.add();
+	if (error)
+		command.errors.add();
+	command.total_ns.add(ns);
+	command.max_ns.set_max(ns);
+	command.latency[latency_bucket(ns)].add();
+}
+
+uint64_t Metrics::percentile(const MetricsSnapshot::Command &command, double percent)
+{
+	uint64_t rank = std::ceil(percent / 100 * command.count), seen = 0;
+	for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+		seen += command.latency[b];
+		if (seen >= rank && seen > 0)
+			return std::min(latency_upper(b), command.max_ns);
+	}
+	return command.max_ns;
+}
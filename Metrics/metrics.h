@@ -0,0 +1,71 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "../Query/query.h"
+
+/* Задержки до 8 нс хранятся точно, далее каждый интервал [2^k, 2^(k+1)) нс делится на 4 корзины. */
+#define LATENCY_SUB_BITS 3
+#define LATENCY_BUCKETS ((1 << LATENCY_SUB_BITS) + (64 - LATENCY_SUB_BITS) * (1 << (LATENCY_SUB_BITS - 1)))
+
+/*
+ * Счётчик, в который пишет только поток-владелец, а читать может кто угодно. Атомарность нужна
+ * лишь для чтения без гонок, поэтому увеличение - это обычные load/store с memory_order_relaxed
+ * без блокировки шины, и статистику не нужно выключать в боевом режиме.
+ */
+class Counter
+{
+  private:
+	std::atomic<uint64_t> _value{0};
+
+  public:
+	void add(uint64_t n = 1) { _value.store(_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+	void set_max(uint64_t x) { if (x > get()) _value.store(x, std::memory_order_relaxed); }
+	uint64_t get() const { return _value.load(std::memory_order_relaxed); }
+};
+
+/* Способы поиска кандидатов в Database::find (совпадают с Database::AccessPath). */
+typedef enum { LOOKUP_TEACHER_INDEX, LOOKUP_SUBJECT_INDEX, LOOKUP_SCAN, NUM_OF_LOOKUPS } LookupType;
+
+/* Набор показателей; C - Counter для счётчиков потока и uint64_t для их суммы. */
+template <class C>
+struct MetricsData
+{
+	struct Command {
+		C count;
+		C errors;
+		C total_ns;
+		C max_ns;
+		C latency[LATENCY_BUCKETS];
+	};
+	Command commands[NUM_OF_QUERY_TYPES];	// VOID - запросы, которые не удалось разобрать
+	C rows_scanned;		// ячейки, проверенные на соответствие условиям
+	C rows_returned;	// строки, отправленные клиентам командой print
+	C lookups[NUM_OF_LOOKUPS];
+	C bytes_in;
+	C bytes_out;
+	C snapshot_reads;	// запросы, исполненные на снимке в фоновом потоке
+	C pages_copied;		// страницы, скопированные писателем, потому что их держал снимок
+	C io_syscalls;		// системные вызовы сетевого цикла сервера (ожидание, чтение, отправка)
+};
+
+using MetricsShard = MetricsData<Counter>;
+using MetricsSnapshot = MetricsData<uint64_t>;
+
+class Metrics
+{
+  public:
+	/* Счётчики текущего потока (создаются при первом обращении и живут до конца программы). */
+	static MetricsShard& local();
+	/* Сумма счётчиков всех потоков. */
+	static MetricsSnapshot collect();
+	static std::chrono::steady_clock::time_point started();
+
+	static void record_query(QueryType type, bool error, uint64_t ns);
+	/* Верхняя граница задержки, которую не превышают percent процентов запросов. */
+	static uint64_t percentile(const MetricsSnapshot::Command &command, double percent);
+};
+
+#endif // METRICS_H
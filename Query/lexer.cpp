@@ -0,0 +1,27 @@
+#include <cctype>
+#include "lexer.h"
+
+static bool is_space(char c)
+{
+	return std::isspace(static_cast<unsigned char>(c));
+}
+
+std::string_view Lexer::next()
+{
+	while (_pos < _text.size() && is_space(_text[_pos]))
+		++_pos;
+	size_t begin = _pos;
+	while (_pos < _text.size() && !is_space(_text[_pos]))
+		++_pos;
+	return _text.substr(begin, _pos - begin);
+}
+
+bool iequals(std::string_view a, std::string_view b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i)
+		if (std::toupper(static_cast<unsigned char>(a[i])) != std::toupper(static_cast<unsigned char>(b[i])))
+			return false;
+	return true;
+}
@@ -0,0 +1,24 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <string_view>
+
+/* Разбивает строку запроса на токены, разделённые пробельными символами, ничего не копируя. */
+class Lexer
+{
+  private:
+	std::string_view _text;
+	size_t _pos;
+
+  public:
+	explicit Lexer(std::string_view text) : _text(text), _pos(0) {}
+	/* Следующий токен (пустой, если токены закончились). */
+	std::string_view next();
+	/* Не разобранный ещё остаток строки, включая пробелы. */
+	std::string_view rest() const { return _text.substr(_pos); }
+};
+
+/* Сравнение строк без учёта регистра. */
+bool iequals(std::string_view a, std::string_view b);
+
+#endif // LEXER_H
@@ -1,62 +1,125 @@
+#include <charconv>
 #include "query.h"
+#include "../Transport/protocol.h"
 
-const Factory<Query, std::string>& Query::factory()
+static const std::pair<std::string_view, QueryType> Commands[] = {
+	{"stop", STOP},
+	{"shutdown", SHUTDOWN},
+	{"insert", INSERT},
+	{"remove", REMOVE},
+	{"select", SELECT},
+	{"reselect", RESELECT},
+	{"print", PRINT},
+	{"prepare", PREPARE},
+	{"execute", EXECUTE},
+	{"stats", STATS},
+	{"explain", EXPLAIN},
+	{"trace", TRACE},
+	{"aggregate", AGGREGATE},
+	{"count", COUNT},
+	{"free", FREE},
+	{"truncate", TRUNCATE},
+	{"memory", MEMORY},
+	{"compact", COMPACT}
+};
+
+QueryType Query::recognize_command(std::string_view name)
+{
+	for (const auto &[word, type] : Commands)
+		if (iequals(name, word))
+			return type;
+	return VOID;
+}
+
+std::string_view Query::command_name(QueryType type)
 {
-	static const Factory<Query, std::string> ret(
-	[](){
-		Factory<Query, std::string> tmp;
-		tmp.add<StopQuery>("STOP");
-		tmp.add<ShutdownQuery>("SHUTDOWN");
-		tmp.add<InsertQuery>("INSERT");
-		tmp.add<RemoveQuery>("REMOVE");
-		tmp.add<SelectQuery>("SELECT");
-		tmp.add<ReselectQuery>("RESELECT");
-		tmp.add<PrintQuery>("PRINT");
-		return tmp;
-	}());
-	return ret;
+	for (const auto &[word, t] : Commands)
+		if (t == type)
+			return word;
+	return "invalid";
 }
 
-Field Query::recognize_field(std::string name) const
+Field Query::recognize_field(std::string_view name) const
 {
-	std::transform(name.begin(), name.end(), name.begin(), toupper);
-	auto it = Field_Vocabulary.find(name);
-	if (it == Field_Vocabulary.end())
-		throw QueryExcSyntax("No such field exists!");
-	return it->second;
+	for (const auto &[word, field] : Field_Vocabulary)
+		if (iequals(name, word))
+			return field;
+	throw QueryExcSyntax("No such field exists!");
 }
 
-Query* Query::create_query(const std::string &str)
+AnyQuery parse_query(std::string_view str)
 {
-	std::stringstream ss(str);
-	std::string command;
-	ss >> command;
-	std::transform(command.begin(), command.end(), command.begin(), toupper);
-	if (!factory().is_registered(command))
+	Lexer lex(str);
+	AnyQuery res;
+	switch (Query::recognize_command(lex.next())) {
+	case STOP:		res.emplace<StopQuery>(); break;
+	case SHUTDOWN:	res.emplace<ShutdownQuery>(); break;
+	case INSERT:	res.emplace<InsertQuery>(); break;
+	case REMOVE:	res.emplace<RemoveQuery>(); break;
+	case SELECT:	res.emplace<SelectQuery>(); break;
+	case RESELECT:	res.emplace<ReselectQuery>(); break;
+	case PRINT:		res.emplace<PrintQuery>(); break;
+	case PREPARE:	res.emplace<PrepareQuery>(); break;
+	case EXECUTE:	res.emplace<ExecuteQuery>(); break;
+	case STATS:		res.emplace<StatsQuery>(); break;
+	case EXPLAIN:	res.emplace<ExplainQuery>(); break;
+	case TRACE:		res.emplace<TraceQuery>(); break;
+	case AGGREGATE:	res.emplace<AggregateQuery>(false); break;
+	case COUNT:		res.emplace<AggregateQuery>(true); break;
+	case FREE:		res.emplace<FreeQuery>(); break;
+	case TRUNCATE:	res.emplace<TruncateQuery>(); break;
+	case MEMORY:	res.emplace<MemoryQuery>(); break;
+	case COMPACT:	res.emplace<CompactQuery>(); break;
+	default:
 		throw QueryExcSyntax("No such command exists!");
-	Query *res = factory().create(command);
-	try {
-		res->parse(ss);
-	} catch (...) {
-		delete res;
-		throw;
 	}
+	std::visit([&lex](auto &query) { query.parse(lex); }, res);
 	return res;
 }
 
-void StopQuery::parse(std::istream &is)
+void StopQuery::parse(Lexer &lex)
 {
-	if (is.get() != EOF)
-		throw QueryExcSyntax("\'stop\' command must be one word!");
+	if (!lex.rest().empty())
+		throw QueryExcSyntax("'stop' command must be one word!");
 }
 
-void ShutdownQuery::parse(std::istream &is)
+void ShutdownQuery::parse(Lexer &lex)
 {
-	if (is.get() != EOF)
-		throw QueryExcSyntax("\'shutdown\' command must be one word!");
+	if (!lex.rest().empty())
+		throw QueryExcSyntax("'shutdown' command must be one word!");
 }
 
-int ConditionalQuery::recognize_int(Field field, const std::string &text, BoundaryType bt) const
+void StatsQuery::parse(Lexer &lex)
+{
+	if (!lex.rest().empty())
+		throw QueryExcSyntax("'stats' command must be one word!");
+}
+
+void TruncateQuery::parse(Lexer &lex)
+{
+	if (!lex.rest().empty())
+		throw QueryExcSyntax("'truncate' command must be one word!");
+}
+
+void MemoryQuery::parse(Lexer &lex)
+{
+	if (!lex.rest().empty())
+		throw QueryExcSyntax("'memory' command must be one word!");
+}
+
+void CompactQuery::parse(Lexer &lex)
+{
+	if (!lex.rest().empty())
+		throw QueryExcSyntax("'compact' command must be one word!");
+}
+
+void TraceQuery::parse(Lexer &lex)
+{
+	if (!lex.rest().empty())
+		throw QueryExcSyntax("'trace' command must be one word!");
+}
+
+int ConditionalQuery::recognize_int(Field field, std::string_view text, BoundaryType bt)
 {
 	if (text == "*") {
 		if (bt == SINGLE)
@@ -71,11 +134,13 @@ int ConditionalQuery::recognize_int(Field field, const std::string &text, Bounda
 			return bt == LEFT ? 0 : NUM_OF_GROUPS;
 	}
 
-	if (std::find_if(text.begin(), text.end(), [](char c)
-					 { return !std::isdigit(c); }) != text.end())
+	int x = 0;
+	auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), x);
+	if (text.empty() || !std::isdigit(static_cast<unsigned char>(text.front())) ||
+		end != text.data() + text.size())
 		throw QueryExcSyntax("Your query is syntactically incorrect!");
-	int x = std::stoi(text);
-	if ((field == ROOM && x > NUM_OF_ROOMS) ||
+	if (ec == std::errc::result_out_of_range ||
+		(field == ROOM && x > NUM_OF_ROOMS) ||
 		(field == DAY && (x == 0 || x > NUM_OF_DAYS)) ||
 		(field == PERIOD && (x == 0 || x > NUM_OF_PERIODS)) ||
 		(field == GROUP && x > NUM_OF_GROUPS))
@@ -124,57 +189,69 @@ ConditionalQuery::ConditionalQuery(const std::vector<Condition> &conditions) : _
 	std::sort(_conditions.begin(), _conditions.end(), cmp);
 }
 
-void ConditionalQuery::parse(std::istream &is)
+std::pair<std::string_view, std::string_view> ConditionalQuery::split_condition(std::string_view tok)
 {
-	if (is.get() == EOF)
+	size_t separator = tok.find('=');
+	if (separator == std::string_view::npos || separator == tok.length() - 1)
 		throw QueryExcSyntax("Your query is syntactically incorrect!");
-	std::string tok;
-	while (is >> tok)
-	{
-		Condition cond;
-		std::string::size_type separator = tok.find('=');
-		if (separator == std::string::npos || separator == tok.length() - 1)
-			throw QueryExcSyntax("Your query is syntactically incorrect!");
-		std::string field_name(tok, 0, separator);
-		std::string cond_text(tok, separator + 1);
-		cond.field = recognize_field(field_name);
-
-		if (cond.field == TEACHER || cond.field == SUBJECT) {
-			if (cond_text.back() == '*') {
-				cond.relation = BEGIN;
-				cond_text.pop_back();
-			} else {
-				cond.relation = EQUAL;
-			}
-			if (std::find_if(cond_text.begin(), cond_text.end(), [](char c) {
-						return !(std::isalpha(c) || c == '.' || c == '-');
-					}) != cond_text.end())
-				throw QueryExcSyntax("Your query is syntactically incorrect!");
-			cond.value = cond_text;
+	return {tok.substr(0, separator), tok.substr(separator + 1)};
+}
+
+Condition ConditionalQuery::make_condition(Field field, std::string_view text)
+{
+	Condition cond;
+	cond.field = field;
+	if (field == TEACHER || field == SUBJECT) {
+		if (text.back() == '*') {
+			cond.relation = BEGIN;
+			text.remove_suffix(1);
+		} else {
+			cond.relation = EQUAL;
 		}
-		else {
-			separator = cond_text.find('-');
-			if (separator != std::string::npos && separator != 0 && separator != cond_text.length() - 1) {
-				cond.relation = RANGE;
-				std::string val1(cond_text, 0, separator);
-				std::string val2(cond_text, separator + 1);
-				int x = recognize_int(cond.field, val1, LEFT);
-				int y = recognize_int(cond.field, val2, RIGHT);
-				cond.value = std::make_pair(std::min(x, y), std::max(x, y));
-			} else {
-				cond.relation = EQUAL;
-				cond.value = recognize_int(cond.field, cond_text, SINGLE);
-			}
+		if (std::find_if(text.begin(), text.end(), [](char c) {
+					return !(std::isalpha(static_cast<unsigned char>(c)) || c == '.' || c == '-');
+				}) != text.end())
+			throw QueryExcSyntax("Your query is syntactically incorrect!");
+		cond.value.emplace<std::string>(text);
+	}
+	else {
+		size_t separator = text.find('-');
+		if (separator != std::string_view::npos && separator != 0 && separator != text.length() - 1) {
+			cond.relation = RANGE;
+			int x = recognize_int(field, text.substr(0, separator), LEFT);
+			int y = recognize_int(field, text.substr(separator + 1), RIGHT);
+			cond.value = std::make_pair(std::min(x, y), std::max(x, y));
+		} else {
+			cond.relation = EQUAL;
+			cond.value = recognize_int(field, text, SINGLE);
 		}
-		_conditions.push_back(cond);
 	}
-	
+	return cond;
+}
+
+void ConditionalQuery::sort_conditions()
+{
+	if (_conditions.empty())
+		throw QueryExcSyntax("Your query is syntactically incorrect!");
 	std::sort(_conditions.begin(), _conditions.end(), cmp);
 	for (size_t i = 0; i < _conditions.size() - 1; i++)
 		if (_conditions[i].field == _conditions[i + 1].field)
 			throw QueryExcSyntax("One field - one condition!");
 }
 
+void ConditionalQuery::parse(Lexer &lex)
+{
+	if (lex.rest().empty())
+		throw QueryExcSyntax("Your query is syntactically incorrect!");
+	_conditions.reserve(NUM_OF_FIELDS);
+	for (std::string_view tok = lex.next(); !tok.empty(); tok = lex.next())
+	{
+		auto [field_name, text] = split_condition(tok);
+		_conditions.push_back(make_condition(recognize_field(field_name), text));
+	}
+	sort_conditions();
+}
+
 ConditionalQuery& ConditionalQuery::operator*=(const ConditionalQuery &other)
 {
 	const std::vector<Condition> &conds1 = _conditions;
@@ -216,9 +293,9 @@ InsertQuery::InsertQuery(const Record &record)
 	std::sort(_conditions.begin(), _conditions.end(), cmp);
 }
 
-void InsertQuery::parse(std::istream &is)
+void InsertQuery::parse(Lexer &lex)
 {
-	ConditionalQuery::parse(is);
+	ConditionalQuery::parse(lex);
 	if (_conditions.size() < NUM_OF_FIELDS)
 		throw QueryExcSyntax("All fields must be set!");
 	for (const Condition &cond : _conditions)
@@ -226,16 +303,14 @@ void InsertQuery::parse(std::istream &is)
 			throw QueryExcSyntax("Invalid field format!");
 }
 
-void PrintQuery::parse(std::istream &is)
+void PrintQuery::parse(Lexer &lex)
 {
-	if (is.get() == EOF)
+	if (lex.rest().empty())
 		throw QueryExcSyntax("Your query is syntactically incorrect!");
-	std::string tok;
 	bool reading_sort = false;
-	while (is >> tok)
+	for (std::string_view tok = lex.next(); !tok.empty(); tok = lex.next())
 	{
-		std::transform(tok.begin(), tok.end(), tok.begin(), toupper);
-		if (tok == "SORT") {
+		if (iequals(tok, "SORT")) {
 			if (reading_sort)
 				throw QueryExcSyntax("Query can only include one 'sort' keyword");
 			reading_sort = true;
@@ -248,41 +323,194 @@ void PrintQuery::parse(std::istream &is)
 	}
 }
 
-void QueryResult::send_int(int fd, int number)
+void AggregateQuery::parse(Lexer &lex)
 {
-	int bytes_sent = send(fd, &number, sizeof(number), MSG_WAITALL);
-	if (bytes_sent != sizeof(number))
-		throw QueryExcSend("Cannot send integer");
+	typedef enum { CONDITIONS, GROUP_BY, AGGREGATES } Part;
+	Part part = CONDITIONS;
+	for (std::string_view tok = lex.next(); !tok.empty(); tok = lex.next())
+	{
+		if (tok.find('=') != std::string_view::npos) {
+			if (part != CONDITIONS)
+				throw QueryExcSyntax("Conditions must precede 'by' and aggregates!");
+			auto [field_name, text] = split_condition(tok);
+			_conditions.push_back(make_condition(recognize_field(field_name), text));
+		} else if (iequals(tok, "BY")) {
+			if (part != CONDITIONS)
+				throw QueryExcSyntax("Query can only include one 'by' keyword before aggregates!");
+			part = GROUP_BY;
+		} else if (!_count_only && iequals(tok, "COUNT")) {
+			_aggregates.push_back({AGG_COUNT, TEACHER});
+			part = AGGREGATES;
+		} else if (!_count_only && (iequals(tok, "MIN") || iequals(tok, "MAX"))) {
+			Field field = recognize_field(lex.next());
+			if (field == TEACHER || field == SUBJECT)
+				throw QueryExcSyntax("'min' and 'max' apply to numeric fields only!");
+			_aggregates.push_back({iequals(tok, "MIN") ? AGG_MIN : AGG_MAX, field});
+			part = AGGREGATES;
+		} else if (part == GROUP_BY) {
+			_groupby.push_back(recognize_field(tok));
+		} else {
+			throw QueryExcSyntax("Your query is syntactically incorrect!");
+		}
+	}
+
+	if (_count_only)
+		_aggregates.push_back({AGG_COUNT, TEACHER});
+	if (_aggregates.empty())
+		throw QueryExcSyntax("Specify at least one of 'count', 'min' or 'max'!");
+	if (part != CONDITIONS && _groupby.empty() && (_count_only || part == GROUP_BY))
+		throw QueryExcSyntax("Specify fields after 'by'!");
+	if (!_conditions.empty())
+		sort_conditions();
+}
+
+void FreeQuery::parse(Lexer &lex)
+{
+	for (std::string_view tok = lex.next(); !tok.empty(); tok = lex.next())
+	{
+		if (iequals(tok, "LIMIT")) {
+			if (_limit != 0)
+				throw QueryExcSyntax("Query can only include one 'limit' keyword");
+			std::string_view text = lex.next();
+			auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), _limit);
+			if (text.empty() || !std::isdigit(static_cast<unsigned char>(text.front())) ||
+				end != text.data() + text.size() || ec != std::errc() || _limit == 0)
+				throw QueryExcValue("Limit must be a positive number!");
+			continue;
+		}
+		auto [field_name, text] = split_condition(tok);
+		Condition cond = make_condition(recognize_field(field_name), text);
+		if (cond.field == SUBJECT)
+			throw QueryExcSyntax("Subject can't be used in 'free'!");
+		if ((cond.field == TEACHER || cond.field == GROUP) && cond.relation != EQUAL)
+			throw QueryExcSyntax("Teacher and group must be set exactly!");
+		_conditions.push_back(cond);
+	}
+	if (!_conditions.empty())
+		sort_conditions();
+}
+
+void ExplainQuery::parse(Lexer &lex)
+{
+	switch (recognize_command(lex.next())) {
+	case SELECT:	_query.emplace<SelectQuery>(); break;
+	case REMOVE:	_query.emplace<RemoveQuery>(); break;
+	case PRINT:		_query.emplace<PrintQuery>(); break;
+	default:
+		throw QueryExcSyntax("Only 'select', 'remove' and 'print' can be explained!");
+	}
+	std::visit([&lex](auto &query) { query.parse(lex); }, _query);
+}
+
+void PrepareQuery::parse(Lexer &lex)
+{
+	_command = recognize_command(lex.next());
+	if (_command != INSERT && _command != REMOVE && _command != SELECT && _command != RESELECT)
+		throw QueryExcSyntax("Only 'insert', 'remove', 'select' and 'reselect' can be prepared!");
+	if (lex.rest().empty())
+		throw QueryExcSyntax("Your query is syntactically incorrect!");
+
+	std::vector<Field> params;
+	_conditions.reserve(NUM_OF_FIELDS);
+	for (std::string_view tok = lex.next(); !tok.empty(); tok = lex.next())
+	{
+		auto [field_name, text] = split_condition(tok);
+		Field field = recognize_field(field_name);
+		if (text == "?") {
+			params.push_back(field);
+			_conditions.push_back({field, EQUAL, 0}); // значение будет подставлено при исполнении
+		} else {
+			_conditions.push_back(make_condition(field, text));
+		}
+	}
+	sort_conditions();
+
+	for (Field field : params)
+		for (size_t i = 0; i < _conditions.size(); ++i)
+			if (_conditions[i].field == field)
+				_slots.push_back(i);
+	if (_command == INSERT) {
+		if (_conditions.size() < NUM_OF_FIELDS)
+			throw QueryExcSyntax("All fields must be set!");
+		for (const Condition &cond : _conditions)
+			if (cond.relation != EQUAL)
+				throw QueryExcSyntax("Invalid field format!");
+	}
+}
+
+bool PrepareQuery::is_param(Field field) const
+{
+	for (size_t slot : _slots)
+		if (_conditions[slot].field == field)
+			return true;
+	return false;
+}
+
+std::vector<Condition> PrepareQuery::bind(Lexer &values) const
+{
+	std::vector<Condition> conds = _conditions;
+	for (size_t slot : _slots) {
+		std::string_view text = values.next();
+		if (text.empty())
+			throw QueryExcSyntax("Too few values for the prepared query!");
+		conds[slot] = make_condition(conds[slot].field, text);
+		if (_command == INSERT && conds[slot].relation != EQUAL)
+			throw QueryExcSyntax("Invalid field format!");
+	}
+	if (!values.next().empty())
+		throw QueryExcSyntax("Too many values for the prepared query!");
+	return conds;
 }
 
-void QueryResult::send_str(int fd, const char *str)
+void ExecuteQuery::parse(Lexer &lex)
 {
-	int len = strlen(str);
-	send_int(fd, len);
-	int bytes_sent = send(fd, str, len, MSG_WAITALL);
-	if (bytes_sent != len)
-		throw QueryExcSend("Cannot send string");
+	std::string_view handle = lex.next();
+	auto [end, ec] = std::from_chars(handle.data(), handle.data() + handle.size(), _handle);
+	if (handle.empty() || ec != std::errc() || end != handle.data() + handle.size() || _handle < 0)
+		throw QueryExcSyntax("Your query is syntactically incorrect!");
+	_values = lex.rest();
 }
 
-void QueryResult::send_result(int fd) const
+/* Ответ собирается целиком и уходит одним send(): мелкие send() подряд упираются в алгоритм Нейгла. */
+std::string_view QueryResult::serialize() const
 {
-	send_int(fd, _protcode);
+	static std::string buf;	// переиспользуется между ответами
+	buf.clear();
+	put_int(buf, _protcode);
 	switch (_protcode)
 	{
 	case SUCCESS:
 		break;
 	case PRINT_DATA: {
-		const auto &rows = std::get<std::vector<std::string>>(_info);
+		const auto &rows = std::get<Rows>(_info);
 		int n = rows.size();
-		send_int(fd, n);
+		put_int(buf, n);
 		for (int i = 0; i < n; ++i)
-			send_str(fd, rows[i].c_str());
+			put_frame(buf, rows[i]);
 		break;
 	}
 	case QUIT:
 		break;
+	case PREPARED:
+		put_int(buf, std::get<int>(_info));
+		break;
 	case ERROR:
-		send_str(fd, std::get<const char*>(_info));
+		put_frame(buf, std::get<const char*>(_info));
 		break;
 	}
+	return buf;
+}
+
+size_t QueryResult::send_result(int fd) const
+{
+	std::string_view buf = serialize();
+	const char *ptr = buf.data();
+	size_t left = buf.size();
+	while (left > 0) {
+		ssize_t bytes_sent = send(fd, ptr, left, 0);
+		if (bytes_sent <= 0)
+			throw QueryExcSend("Cannot send the answer");
+		ptr += bytes_sent, left -= bytes_sent;
+	}
+	return buf.size();
 }
@@ -1,134 +1,300 @@
 #ifndef QUERY_H
 #define QUERY_H
 
-#include <istream>
 #include <string>
-#include <sstream>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <memory_resource>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <cstring>
 #include <cctype>
 #include <variant>
 #include <utility>
+#include <algorithm>
 #include "QueryExc.h"
-#include "../Factory/factory.hpp"
+#include "lexer.h"
 #include "../TaskStructures/task_structures.h"
 
 /* Виды запросов. */
-typedef enum { VOID, STOP, SHUTDOWN, INSERT, REMOVE, SELECT, RESELECT, PRINT } QueryType;
+typedef enum {
+	VOID, STOP, SHUTDOWN, INSERT, REMOVE, SELECT, RESELECT, PRINT, PREPARE, EXECUTE, STATS, EXPLAIN, TRACE, AGGREGATE, COUNT,
+	FREE, TRUNCATE, MEMORY, COMPACT, NUM_OF_QUERY_TYPES
+} QueryType;
 
 class Query
 {
-  private:
-	static const Factory<Query, std::string>& factory();
-
   protected:
-	Field recognize_field(std::string name) const;
+	Field recognize_field(std::string_view name) const;
 	
   public:
-	static Query* create_query(const std::string &str);
+	static QueryType recognize_command(std::string_view name);
+	/* Название команды в нижнем регистре (для VOID - "invalid"). */
+	static std::string_view command_name(QueryType type);
 	virtual ~Query() {}
-	virtual void parse(std::istream &is) = 0;
+	virtual void parse(Lexer &lex) = 0;
 	virtual QueryType type() const { return VOID; }
 };
 
-class StopQuery : public Query
+class StopQuery final : public Query
 {
   public:
-	virtual void parse(std::istream &is) override;
+	virtual void parse(Lexer &lex) override;
 	virtual QueryType type() const override { return STOP; }
 };
 
-class ShutdownQuery : public Query
+class ShutdownQuery final : public Query
 {
   public:
-	virtual void parse(std::istream &is) override;
+	virtual void parse(Lexer &lex) override;
 	virtual QueryType type() const override { return SHUTDOWN; }
 };
 
+class StatsQuery final : public Query
+{
+  public:
+	virtual void parse(Lexer &lex) override;
+	virtual QueryType type() const override { return STATS; }
+};
+
+class TraceQuery final : public Query
+{
+  public:
+	virtual void parse(Lexer &lex) override;
+	virtual QueryType type() const override { return TRACE; }
+};
+
+/* Удаление всего расписания разом. */
+class TruncateQuery final : public Query
+{
+  public:
+	virtual void parse(Lexer &lex) override;
+	virtual QueryType type() const override { return TRUNCATE; }
+};
+
+/* Подробный отчёт о занятой памяти. */
+class MemoryQuery final : public Query
+{
+  public:
+	virtual void parse(Lexer &lex) override;
+	virtual QueryType type() const override { return MEMORY; }
+};
+
+/* Возврат лишней памяти, оставшейся после удалений. */
+class CompactQuery final : public Query
+{
+  public:
+	virtual void parse(Lexer &lex) override;
+	virtual QueryType type() const override { return COMPACT; }
+};
+
 class ConditionalQuery : public Query
 {
   private:
 	typedef enum {LEFT, RIGHT, SINGLE} BoundaryType;
-	int recognize_int(Field field, const std::string &text, BoundaryType bt) const;
+	static int recognize_int(Field field, std::string_view text, BoundaryType bt);
 
   protected:
 	std::vector<Condition> _conditions;
 	static bool cmp(const Condition &c1, const Condition &c2) { return c1.field < c2.field; }
 	Condition merge_conditions(const Condition &c1, const Condition &c2) const;
+	/* Делит токен "поле=значение" на имя поля и текст значения. */
+	static std::pair<std::string_view, std::string_view> split_condition(std::string_view tok);
+	/* Сортирует условия по полям и проверяет, что каждое поле встречается не более одного раза. */
+	void sort_conditions();
 
   public:
 	ConditionalQuery() {}
 	ConditionalQuery(const std::vector<Condition> &conditions);
-	virtual void parse(std::istream &is) override;
+	virtual void parse(Lexer &lex) override;
 	const std::vector<Condition>& conditions() const { return _conditions; }
 	ConditionalQuery& operator*=(const ConditionalQuery &other);
+	/* Разбирает значение условия на поле field, записанное в запросе как text. */
+	static Condition make_condition(Field field, std::string_view text);
 };
 
-class InsertQuery : public ConditionalQuery
+class InsertQuery final : public ConditionalQuery
 {
   public:
 	InsertQuery() {}
+	InsertQuery(const std::vector<Condition> &conditions) : ConditionalQuery(conditions) {}
 	InsertQuery(const Record &record);
-	virtual void parse(std::istream &is) override;
+	virtual void parse(Lexer &lex) override;
 	virtual QueryType type() const override { return INSERT; }
 };
 
-class RemoveQuery : public ConditionalQuery
+class RemoveQuery final : public ConditionalQuery
 {
   public:
+	using ConditionalQuery::ConditionalQuery;
 	virtual QueryType type() const override { return REMOVE; }
 };
 
-class SelectQuery : public ConditionalQuery
+class SelectQuery final : public ConditionalQuery
 {
   public:
+	using ConditionalQuery::ConditionalQuery;
 	virtual QueryType type() const override { return SELECT; }
 };
 
-class ReselectQuery : public ConditionalQuery
+class ReselectQuery final : public ConditionalQuery
 {
   public:
+	using ConditionalQuery::ConditionalQuery;
 	virtual QueryType type() const override { return RESELECT; }
 };
 
-class PrintQuery : public Query
+/*
+ * Шаблон условного запроса, в котором вместо некоторых значений стоит знак "?":
+ *   prepare insert teacher=? subject=? room=? day=3 period=? group=?
+ * Шаблон разбирается и проверяется один раз, а затем исполняется командой execute,
+ * которой передаются лишь значения на месте "?" в порядке их следования.
+ */
+class PrepareQuery final : public ConditionalQuery
+{
+  private:
+	QueryType _command;				// какой запрос подготавливается
+	std::vector<size_t> _slots;		// индексы условий-заготовок в порядке следования "?"
+
+  public:
+	virtual void parse(Lexer &lex) override;
+	virtual QueryType type() const override { return PREPARE; }
+	QueryType command() const { return _command; }
+	bool is_param(Field field) const;
+	/* Подставляет значения из values и возвращает готовый (отсортированный) набор условий. */
+	std::vector<Condition> bind(Lexer &values) const;
+};
+
+/* Агрегатная функция над найденными записями: количество или min/max числового поля. */
+typedef enum { AGG_COUNT, AGG_MIN, AGG_MAX } AggregateFunction;
+struct Aggregate
+{
+	AggregateFunction function;
+	Field field;	// не используется для AGG_COUNT
+};
+
+/*
+ * Агрегация по условиям с необязательной группировкой:
+ *   aggregate day=1-3 by teacher count max period
+ *   count teacher=A* by day
+ * count - то же, что aggregate ... count. Условий может не быть вовсе.
+ */
+class AggregateQuery final : public ConditionalQuery
+{
+  private:
+	bool _count_only;
+	std::vector<Field> _groupby;
+	std::vector<Aggregate> _aggregates;
+
+  public:
+	AggregateQuery(bool count_only = false) : _count_only(count_only) {}
+	virtual void parse(Lexer &lex) override;
+	virtual QueryType type() const override { return _count_only ? COUNT : AGGREGATE; }
+	const std::vector<Field>& groupby() const { return _groupby; }
+	const std::vector<Aggregate>& aggregates() const { return _aggregates; }
+	bool count_only() const { return _aggregates.size() == 1 && _aggregates[0].function == AGG_COUNT; }
+};
+
+/*
+ * Поиск свободных ячеек (день, пара, аудитория) в заданных диапазонах, в которые можно поставить
+ * занятие преподавателя teacher у группы group, не больше limit штук:
+ *   free room=100-199 day=3 teacher=G.I.Khomutov group=210 limit 5
+ */
+class FreeQuery final : public ConditionalQuery
+{
+  private:
+	size_t _limit = 0;	// 0 - без ограничения
+
+  public:
+	virtual void parse(Lexer &lex) override;
+	virtual QueryType type() const override { return FREE; }
+	size_t limit() const { return _limit; }
+};
+
+class ExecuteQuery final : public Query
+{
+  private:
+	int _handle;
+	std::string_view _values;	// ссылается на текст запроса и действительна, пока он обрабатывается
+
+  public:
+	virtual void parse(Lexer &lex) override;
+	virtual QueryType type() const override { return EXECUTE; }
+	int handle() const { return _handle; }
+	std::string_view values() const { return _values; }
+};
+
+class PrintQuery final : public Query
 {
   private:
 	std::vector<Field> _fields;
 	std::vector<Field> _sortby;
 
   public:
-	virtual void parse(std::istream &is) override;
+	virtual void parse(Lexer &lex) override;
 	virtual QueryType type() const override { return PRINT; }
 	const std::vector<Field>& fields() const { return _fields; }
 	const std::vector<Field>& sortby() const { return _sortby; }
 };
 
+/*
+ * Запрос select, remove или print, который нужно не исполнить, а объяснить: какой путь доступа
+ * выбран, сколько ячеек просмотрено и сколько времени ушло на каждую фазу. Изменений в базе и в
+ * сессии он не делает.
+ */
+class ExplainQuery final : public Query
+{
+  public:
+	using Explained = std::variant<SelectQuery, RemoveQuery, PrintQuery>;
+
+  private:
+	Explained _query;
+
+  public:
+	virtual void parse(Lexer &lex) override;
+	virtual QueryType type() const override { return EXPLAIN; }
+	const Explained& query() const { return _query; }
+};
+
+
+/*
+ * Любой запрос. Разобранный запрос хранится по значению (без выделения памяти в куче под сам
+ * объект запроса) и исполняется через std::visit.
+ */
+using AnyQuery = std::variant<StopQuery, ShutdownQuery, InsertQuery, RemoveQuery, SelectQuery,
+							  ReselectQuery, PrintQuery, PrepareQuery, ExecuteQuery, StatsQuery,
+							  ExplainQuery, TraceQuery, AggregateQuery, FreeQuery, TruncateQuery,
+							  MemoryQuery, CompactQuery>;
+
+AnyQuery parse_query(std::string_view str);
 
 
 class QueryResult
 {
+  public:
+	// Строки таблицы живут в памяти сессии до её следующего запроса
+	using Rows = std::pmr::vector<std::pmr::string>;
+
   private:
-	// Сообщение об ошибке или строки таблицы, запрошенные командой print
-	using InfoForClient = std::variant< const char*, std::vector<std::string> >;
+	// Сообщение об ошибке, строки таблицы, запрошенные командой print, или номер подготовленного запроса
+	using InfoForClient = std::variant< const char*, Rows, int >;
 
 	ServerCode _servcode;	// Информация для сервера (например, отключить клиента)
 	ProtocolCode _protcode;	// Код результата в соответствии с протоколом взаимодействия сервер-клиент
 	InfoForClient _info;
 
-	static void send_int(int fd, int number);
-	static void send_str(int fd, const char *str);
-
   public:
 	QueryResult() {}
 	void set_servcode(ServerCode code) { _servcode = code; }
 	void set_protcode(ProtocolCode code) { _protcode = code; }
-	void set_info(const InfoForClient &info) { _info = info; }
+	void set_info(InfoForClient &&info) { _info = std::move(info); }
 	ServerCode get_servcode() const { return _servcode; }
-	void send_result(int fd) const;
+	ProtocolCode get_protcode() const { return _protcode; }
+	/* Ответ в том виде, в каком он уходит клиенту (буфер общий и переиспользуется следующим вызовом). */
+	std::string_view serialize() const;
+	/* Возвращает количество отправленных байт. */
+	size_t send_result(int fd) const;
 };
 
 
@@ -1,43 +1,101 @@
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <sys/poll.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <cerrno>
 #include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <fstream>
+#include <chrono>
 #include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+#include <utility>
 #include <algorithm>
 #include <exception>
+#include <thread>
 
 #include "../Database/database.h"
+#include "../Journal/journal.h"
+#include "../Journal/checkpoint.h"
+#include "../Journal/replication.h"
+#include "../Trace/trace.h"
+#include "../Transport/shm_ring.h"
+#include "../Transport/io_loop.h"
 #include "../TaskStructures/task_structures.h"
 
 #define PORT 5555
 #define QUEUE_SIZE 3		// размер очереди входящих запросов соединения
 #define MAX_CONNECTIONS	10	// максимальное количество одновременных соединений
+#define READER_THREADS 2	// потоки, исполняющие долгие print на снимках базы (0 - исполнять сразу)
+#define DAY_PARTITIONS 1	// 1 - у каждого дня свой поток для изменений и поиска (если ядер больше одного)
+#define UNIX_SOCKET 1		// 1 - принимать соединения и на Unix-сокете server.PORT.sock
+#define IO_URING 1			// 1 - сетевой цикл на io_uring, если ядро его поддерживает (иначе poll)
+
+#define DATA_FILE "data.txt"				// снимок базы данных
+#define JOURNAL_FILE "data.wal"				// журнал изменений, сделанных после снимка
+#define JOURNAL_SYNC Journal::SYNC_ALWAYS	// когда сбрасывать журнал на диск
+#define JOURNAL_SYNC_INTERVAL 1000			// интервал в мс для Journal::SYNC_PERIODIC
+#define CHECKPOINT_INTERVAL 300				// снимок не реже чем раз в столько секунд (0 - никогда)
+#define CHECKPOINT_WRITES 100000			// ... или раз в столько изменений (0 - никогда)
+#define STATS_FILE "stats.txt"				// куда периодически выводится статистика (см. команду stats)
+#define STATS_INTERVAL 0					// раз в столько секунд (0 - никогда)
+#define SLOW_LOG_FILE "slow.log"			// журнал медленных запросов
+#define SLOW_QUERY_US 10000					// запрос считается медленным с этого времени в мкс (0 - не вести)
+#define REPLICATION 1						// 1 - ведущий сервер рассылает изменения репликам
+#define REPLICATION_SOCKET "data.repl"		// Unix-сокет, к которому подключаются реплики
+#define REPLICA_MAX_LAG_MS 1000				// реплика отвечает на чтение, если ведущий был на связи не позже
+#define REPLICA_RETRY_MS 500				// как часто реплика пытается подключиться к ведущему
 
 Database database;
+Journal *journal = nullptr;
+Checkpoint *checkpoint = nullptr;
+LogShipper *shipper = nullptr;		// только у ведущего сервера
+LogFollower *follower = nullptr;	// только у реплики
+std::set<int> unix_clients;						// клиенты, подключившиеся через Unix-сокет
+std::map<int, std::unique_ptr<ShmRing>> rings;	// клиенты, получающие ответы через общую память
 
-pollfd act_set[MAX_CONNECTIONS + 1];
-int num_set = 0;
+std::unique_ptr<IoLoop> io;
 
-/* Закрывает сокет, при этом корректирует счётчик цикла проверки сокетов. */
-void closeSocket(int &index);
+/* Закрывает соединение с клиентом и забывает всё, что сервер о нём хранил. */
+void closeClient(int fd);
 void closeAllSockets();
-int readStrFromClient(int fd, std::string &str);
+/* Слушающий Unix-сокет по пути path (-1, если создать его не удалось). */
+int listenUnix(const std::string &path);
+/* Отправляет ответ через кольцо клиента, если оно есть и ответ в нём помещается, иначе по сокету. */
+size_t sendAnswer(int fd, const QueryResult &result);
+/* Наименьший из таймаутов ожидания, где -1 означает бесконечность. */
+int minTimeout(int a, int b);
+/* Записывает статистику в STATS_FILE, если пришло время, и возвращает мс до следующей записи. */
+int dumpStats();
 
-int main(void)
+/*
+ * ./runme - ведущий сервер на порту PORT. ./runme replica PORT - реплика на порту PORT: она
+ * получает изменения от ведущего сервера, запущенного в том же каталоге, и отвечает только на
+ * запросы на чтение. Файлов реплика не пишет, а при запуске догоняет ведущий по его снимку.
+ */
+int main(int argc, char **argv)
 {
+	bool replica = (argc == 3 && !strcmp(argv[1], "replica"));
+	int port = replica ? atoi(argv[2]) : PORT;
+	if ((argc != 1 && !replica) || port <= 0 || port > 65535) {
+		std::cout << "Usage: runme [replica PORT]" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
 	int err, opt = 1;
-	int sock, new_sock;
+	int sock;
 	struct sockaddr_in server;
-	struct sockaddr_in client;
 
 	/* Заполняем структуру адреса, на котором будет работать сервер. */
 	server.sin_family = AF_INET; // IP
 	server.sin_addr.s_addr = htonl(INADDR_ANY); // любой сетевой интерфейс
-	server.sin_port = htons(PORT);	// избегаем проблем с порядком байт в записи числа
+	server.sin_port = htons(port);	// избегаем проблем с порядком байт в записи числа
 
 	/* Создаём канал для сетевого обмена, задаём семейство протоколов и конкретный протокол обмена. */
 	sock = socket(PF_INET, SOCK_STREAM, 0); // TCP сокет
@@ -73,140 +131,294 @@ int main(void)
 		exit(EXIT_FAILURE);
 	}
 	
-	num_set = 1;				// изначально только слушающий сокет 
-	act_set[0].fd = sock;
-	act_set[0].events = POLLIN; // запрошенные события (INput - наличие данных для чтения)
-	act_set[0].revents = 0;		// информация о произошедших событиях
+	io = IoLoop::create(IO_URING); // изначально только слушающий сокет
+	io->add_listener(sock);
+	std::cout << "I/O: " << io->name() << std::endl;
 
+	/* Восстанавливаем состояние: последний снимок плюс журнал изменений после него. */
 	try {
-		database.from_file("data.txt");
+		if (replica) {
+			database.set_replica(true);
+			follower = new LogFollower(database, REPLICATION_SOCKET, REPLICA_MAX_LAG_MS, REPLICA_RETRY_MS);
+		} else {
+			database.from_file(DATA_FILE);
+			database.from_journal(JOURNAL_FILE ".old");
+			database.from_journal(JOURNAL_FILE);
+			database.set_slow_log(SLOW_LOG_FILE, SLOW_QUERY_US);
+		}
+		database.start_readers(READER_THREADS);
+		if (DAY_PARTITIONS && std::thread::hardware_concurrency() > 1)
+			database.start_partitions();
+		if (!replica) {
+			journal = new Journal(JOURNAL_FILE, JOURNAL_SYNC, JOURNAL_SYNC_INTERVAL);
+			checkpoint = new Checkpoint(database, *journal, DATA_FILE, CHECKPOINT_INTERVAL, CHECKPOINT_WRITES);
+			if (REPLICATION)
+				shipper = new LogShipper(REPLICATION_SOCKET);
+		}
 	} catch (const std::exception &e) {
 		std::cout << e.what();
 		closeAllSockets();
 		exit(EXIT_FAILURE);
 	}
+	database.set_journal(journal);
+	int finished_fd = database.finished_fd(); // -1, если потоков нет
+	if (finished_fd >= 0)
+		io->watch(finished_fd);
+	int replication_fd = shipper != nullptr ? shipper->listen_fd() : -1; // у реплики - поток изменений
+	if (replication_fd >= 0)
+		io->watch(replication_fd);
+	std::string unix_path = "server." + std::to_string(port) + ".sock"; // у каждой реплики свой
+	int unix_sock = UNIX_SOCKET ? listenUnix(unix_path) : -1;
+	if (unix_sock >= 0)
+		io->add_listener(unix_sock);
+
+	IoLoop::Events events;	// строки запросов в нём переиспользуются между итерациями
+	std::vector< std::pair<int, std::string_view> > batch;
+	std::string feed;	// группа изменений итерации для реплик
 
 	/* Бесконечный цикл проверки состояния сокетов. */
-	std::cout << "Number of connections: " << num_set - 1 << std::endl;
+	std::cout << "Number of connections: " << io->clients() << std::endl;
 	while (true)
 	{
-		int act_discr;	// количество описателей с обнаруженными событиями или ошибками
-		act_discr = poll(act_set, num_set, -1); // ждём появления данных в каком-либо сокете
-		if (act_discr < 0) {
-			perror("Server poll failure");
+		int timeout = dumpStats();
+		if (journal != nullptr)
+			timeout = minTimeout(minTimeout(journal->timeout(), checkpoint->timeout()), timeout);
+		if (follower != nullptr) {
+			follower->tick();
+			if (follower->fd() != replication_fd) { // реплика подключилась к ведущему или потеряла его
+				if (replication_fd >= 0)
+					io->unwatch(replication_fd);
+				replication_fd = follower->fd();
+				if (replication_fd >= 0)
+					io->watch(replication_fd);
+			}
+			timeout = minTimeout(follower->timeout(), timeout);
+		}
+		try {
+			io->wait(timeout, events); // ждём появления данных в каком-либо сокете
+		} catch (const TransportExc &e) {
+			std::cout << e.what() << std::endl;
 			closeAllSockets();
 			exit(EXIT_FAILURE);
 		}
-		
-		for (int i = 0; i < num_set; ++i)
-		{
-			if (act_set[i].revents ^ POLLIN)
-				continue;
-			
-			act_set[i].revents &= ~POLLIN;
-			if (i == 0)
-			{
-				/* Фактически отвечаем на команду connect от клиента. */
-				socklen_t size = sizeof(client);
-				new_sock = accept(act_set[i].fd, (struct sockaddr*)&client, &size);
-				if (sock < 0) {
-					perror("Server accept failure");
-					closeAllSockets();
-					exit(EXIT_FAILURE);
-				}
-				if (num_set - 1 < MAX_CONNECTIONS) {
-					act_set[num_set].fd = new_sock;
-					act_set[num_set].events = POLLIN;
-					act_set[num_set].revents = 0;
-					database.add_user(act_set[num_set].fd);
-					++num_set;
-					std::cout << "Number of connections: " << num_set - 1 << std::endl;
-				} else {
-					QueryResult result;
-					result.set_protcode(ERROR);
-					result.set_info("Too many connections! Try later!");
-					try {
-						result.send_result(new_sock);
-					} catch (const QueryExcSend &e) {
-						perror(e.what());
-					}
-					std::cout << "Too many connections! The last client was not connected.\n";
-					if (close(new_sock) < 0) {
-						perror("Server cannot close socket");
-						exit(EXIT_FAILURE);
-					}
-				}
-			}
+
+		/*
+		 * Запросы, пришедшие за одну итерацию, образуют группу: сначала все они исполняются,
+		 * затем их изменения одной записью попадают в журнал, и только после этого клиенты
+		 * получают ответы.
+		 */
+		std::vector< std::pair<int, QueryResult> > answers;
+		for (int fd : events.ready) {
+			if (fd == finished_fd)
+				answers = database.finished();
+			else if (shipper != nullptr)
+				shipper->accept(database.snapshot()); // всё изменённое до этой итерации уже разослано
 			else
-			{
-				/* Пришёл запрос в уже существующем соединении. */
-				std::string query;
-				err = readStrFromClient(act_set[i].fd, query);
-				if (err < 0) {
-					perror("Server cannot read string from client");
-					database.remove_user(act_set[i].fd);
-					closeSocket(i);
-					continue;
-				}
-				QueryResult result = database.process_query(act_set[i].fd, query);
+				follower->receive();
+		}
+		if (follower != nullptr)
+			database.set_stale(!follower->fresh());
+
+		for (const auto &[listener, new_sock] : events.accepted) {
+			/* Фактически отвечаем на команду connect от клиента. */
+			const char *refusal = nullptr;
+			if (io->clients() >= MAX_CONNECTIONS)
+				refusal = "Too many connections! Try later!";
+			else if (!database.add_user(new_sock))
+				/* Сессия закрытого соединения с тем же дескриптором ещё ждёт ответа на запрос. */
+				refusal = "The previous connection is still closing! Try later!";
+			if (!refusal) {
+				io->add_client(new_sock);
+				if (listener == unix_sock)
+					unix_clients.insert(new_sock);
+				std::cout << "Number of connections: " << io->clients() << std::endl;
+			} else {
+				QueryResult result;
+				result.set_protcode(ERROR);
+				result.set_info(refusal);
 				try {
-					result.send_result(act_set[i].fd);
+					result.send_result(new_sock);
 				} catch (const QueryExcSend &e) {
 					perror(e.what());
-					database.remove_user(act_set[i].fd);
-					closeSocket(i);
-					continue;
 				}
-				ServerCode code = result.get_servcode();
-				if (code == DISCONNECT_USER) {
-					closeSocket(i);
-					std::cout << "Number of connections: " << num_set - 1 << std::endl;
+				std::cout << refusal << " The last client was not connected.\n";
+				if (close(new_sock) < 0) {
+					perror("Server cannot close socket");
+					exit(EXIT_FAILURE);
 				}
-				else if (code == SERVER_SHUTDOWN) {
-					database.to_file("data.txt");
-					closeAllSockets();
-					std::cout << "Server shutdown\n";
-					return 0;
+			}
+		}
+		for (int fd : events.broken) {
+			std::cout << "Server cannot read string from client" << std::endl;
+			database.remove_user(fd);
+			closeClient(fd);
+		}
+
+		/* Пришли запросы в уже существующих соединениях. */
+		batch.clear();
+		for (size_t q = 0; q < events.received; ++q) {
+			const auto &[fd, query] = events.queries[q];
+			Metrics::local().bytes_in.add(sizeof(int) + query.size());
+			if (query == SHM_HELLO && unix_clients.count(fd)) {
+				/* Не запрос к базе: клиент просит отвечать ему через общую память. */
+				try {
+					rings[fd] = ShmRing::offer(fd);
+				} catch (const TransportExc &e) {
+					std::cout << e.what() << std::endl;
+					database.remove_user(fd);
+					closeClient(fd);
+				}
+				continue;
+			}
+			batch.emplace_back(fd, query);
+		}
+		std::vector<QueryResult> results = database.process_batch(batch);
+		for (size_t q = 0; q < batch.size(); ++q)
+			answers.emplace_back(batch[q].first, std::move(results[q]));
+
+		if (journal != nullptr) {
+			if (shipper != nullptr)
+				feed = journal->group();
+			try {
+				TRACE_SPAN("journal commit");
+				journal->commit();
+				journal->sync();
+			} catch (const JournalExc &e) {
+				std::cout << e.what() << std::endl;
+				closeAllSockets();
+				exit(EXIT_FAILURE);
+			}
+			checkpoint->tick();
+			if (shipper != nullptr)
+				shipper->publish(feed); // реплики получают только то, что уже в журнале
+		}
+
+		bool shutdown = false;
+		std::vector<int> lost;	// клиенты, которым не удалось отправить ответ
+		for (const auto &[fd, result] : answers)
+		{
+			if (result.get_servcode() == ANSWER_LATER) {
+				io->pause(fd, false);
+				continue;
+			}
+			try {
+				TRACE_SPAN("send_result");
+				Metrics::local().bytes_out.add(sendAnswer(fd, result));
+			} catch (const TransportExc &e) {
+				std::cout << e.what() << std::endl;
+				lost.push_back(fd);
+				continue;
+			}
+			ServerCode code = result.get_servcode();
+			if (code == DISCONNECT_USER) {
+				closeClient(fd);
+				std::cout << "Number of connections: " << io->clients() << std::endl;
+			}
+			else if (code == SEND_INFO) {
+				io->pause(fd, true);
+			}
+			else if (code == SERVER_SHUTDOWN) {
+				shutdown = true;
+			}
+		}
+		/* Строки ответов лежат в памяти сессий, поэтому сессии удаляются после ответов. */
+		answers.clear();
+		for (int fd : lost) {
+			database.remove_user(fd);
+			closeClient(fd);
+		}
+		if (shutdown) {
+			/* Снимок включает в себя всё содержимое журнала, поэтому журнал можно очистить. */
+			if (journal != nullptr) {
+				checkpoint->wait();
+				try {
+					database.to_file(DATA_FILE);
+					journal->reset();
+					journal->drop_rotated();
+				} catch (const std::exception &e) {
+					std::cout << e.what() << std::endl;
 				}
 			}
+			delete shipper;
+			delete follower;
+			delete checkpoint;
+			delete journal;
+			closeAllSockets();
+			if (UNIX_SOCKET)
+				unlink(unix_path.c_str());
+			std::cout << "Server shutdown\n";
+			return 0;
 		}
 	}
 }
 
-void closeSocket(int &index)
+void closeClient(int fd)
 {
-	if (close(act_set[index].fd) < 0) {
-		perror("Server cannot close socket");
-		exit(EXIT_FAILURE);
-	}
-	if (index < num_set - 1) {
-		act_set[index] = act_set[num_set - 1];
-		--index;
-	}
-	--num_set;
+	rings.erase(fd);
+	unix_clients.erase(fd);
+	io->remove_client(fd);
 }
 
 void closeAllSockets()
 {
-	for (int i = 0; i < num_set; ++i)
-		closeSocket(i);
+	rings.clear();
+	io.reset(); // закрывает слушающие сокеты и клиентов
 }
 
-int readStrFromClient(int fd, std::string &str)
+int listenUnix(const std::string &path)
 {
-	int len;
-	int bytes_read;
-	bytes_read = recv(fd, &len, sizeof(len), MSG_WAITALL); // считываем длину сообщения
-	if (bytes_read != sizeof(len)) {
+	sockaddr_un addr;
+	if (path.size() >= sizeof(addr.sun_path))
+		return -1;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+	unlink(path.c_str()); // сокет, оставшийся от прошлого запуска
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("Server cannot create Unix socket");
 		return -1;
 	}
-	char *msg = new char[len];
-	bytes_read = recv(fd, msg, len, MSG_WAITALL); // читаем сообщение целиком
-	if (bytes_read != len) {
-		delete[] msg;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, QUEUE_SIZE) < 0) {
+		perror("Server cannot listen on Unix socket");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+size_t sendAnswer(int fd, const QueryResult &result)
+{
+	auto ring = rings.find(fd);
+	std::string_view answer = result.serialize();
+	if (ring == rings.end() || !ring->second->post(answer))
+		io->send(fd, answer);
+	return answer.size();
+}
+
+int minTimeout(int a, int b)
+{
+	if (a < 0)
+		return b;
+	if (b < 0)
+		return a;
+	return std::min(a, b);
+}
+
+int dumpStats()
+{
+	using Clock = std::chrono::steady_clock;
+	static Clock::time_point next = Clock::now() + std::chrono::seconds(STATS_INTERVAL);
+	if (STATS_INTERVAL <= 0)
 		return -1;
+	auto now = Clock::now();
+	if (now >= next) {
+		std::ofstream out(STATS_FILE);
+		for (const std::string &line : database.stats_report())
+			out << line << '\n';
+		if (out.fail())
+			std::cout << "Cannot write statistics to " STATS_FILE << std::endl;
+		next = now + std::chrono::seconds(STATS_INTERVAL);
 	}
-	str = std::string(msg, len);
-	delete[] msg;
-	return 0;
+	return std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
 }
@@ -0,0 +1,227 @@
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <filesystem>
+#include "bench.h"
+#include "../../HashTable/HashTable.hpp"
+
+using namespace std;
+
+/* Имена могут состоять только из букв, поэтому номер записывается "буквенными цифрами". */
+string Bench::name(size_t id)
+{
+	string res;
+	do {
+		res += char('a' + id % 26);
+		id /= 26;
+	} while (id > 0);
+	return res;
+}
+
+Bench::Bench(double fill, size_t teachers, int min_time_ms, unsigned seed) :
+	_fill(fill), _teachers(teachers), _min_time_ms(min_time_ms), _rng(seed), _records(0)
+{
+	_data_file = (filesystem::temp_directory_path() / "schedule_bench_data.txt").string();
+	ofstream out(_data_file);
+	if (!out.is_open())
+		throw runtime_error("Cannot create the data file!");
+
+	/* Накладки отсеиваются сразу, чтобы в базу попало ровно _records записей. */
+	set<pair<int, size_t>> busy_teachers;
+	set<pair<int, int>> busy_groups;
+	bernoulli_distribution used(_fill);
+	for (int t = 0; t < NUM_OF_DAYS * NUM_OF_PERIODS; ++t) {
+		for (int r = 0; r <= NUM_OF_ROOMS; ++r) {
+			if (!used(_rng))
+				continue;
+			size_t tch = get_int(0, _teachers - 1);
+			int grp = get_int(0, NUM_OF_GROUPS);
+			if (!busy_teachers.insert({t, tch}).second || !busy_groups.insert({t, grp}).second)
+				continue;
+			Record rec;
+			rec.teacher = teacher(tch);
+			rec.subject = subject(get_int(0, 1000));
+			rec.room = r;
+			rec.time = Time(t);
+			rec.group = grp;
+			out << rec << '\n';
+			++_records;
+		}
+	}
+}
+
+Bench::~Bench()
+{
+	filesystem::remove(_data_file);
+}
+
+unique_ptr<Database> Bench::load() const
+{
+	auto db = make_unique<Database>();
+	db->from_file(_data_file);
+	db->add_user(1);
+	return db;
+}
+
+void Bench::run(const string &scenario, const function<void(size_t)> &body)
+{
+	using Clock = chrono::steady_clock;
+	const auto limit = chrono::milliseconds(_min_time_ms);
+	size_t ops = 0, batch = 1;
+	Clock::duration elapsed{};
+	auto start = Clock::now();
+	while (elapsed < limit) {
+		for (size_t i = 0; i < batch; ++i)
+			body(ops + i);
+		ops += batch;
+		elapsed = Clock::now() - start;
+		if (batch < 1024)
+			batch *= 2;
+	}
+	double ns = chrono::duration<double, nano>(elapsed).count();
+	_results.push_back({scenario, ops, ns / ops, ops * 1e9 / ns});
+}
+
+void Bench::bench_parse()
+{
+	vector<string> inserts, selects;
+	for (int i = 0; i < 1024; ++i) {
+		inserts.push_back("insert teacher=" + teacher(i) + " subject=" + subject(i) +
+			" room=" + to_string(get_int(0, NUM_OF_ROOMS)) + " day=" + to_string(get_int(1, NUM_OF_DAYS)) +
+			" period=" + to_string(get_int(1, NUM_OF_PERIODS)) + " group=" + to_string(get_int(0, NUM_OF_GROUPS)));
+		selects.push_back("select teacher=" + teacher(i).substr(0, 2) + "* room=" +
+			to_string(get_int(0, 500)) + "-* day=1-" + to_string(get_int(1, NUM_OF_DAYS)));
+	}
+	run("parse_insert", [&](size_t i) { parse_query(inserts[i % inserts.size()]); });
+	run("parse_select", [&](size_t i) { parse_query(selects[i % selects.size()]); });
+	run("parse_print", [](size_t) { parse_query("print teacher subject room day period group sort day period"); });
+}
+
+void Bench::bench_insert_remove()
+{
+	vector<string> inserts, executes, removes;
+	for (int i = 0; i < 1 << 16; ++i) {
+		string tch = teacher(get_int(0, _teachers - 1)), sbj = subject(i);
+		string room = to_string(get_int(0, NUM_OF_ROOMS)), day = to_string(get_int(1, NUM_OF_DAYS));
+		string period = to_string(get_int(1, NUM_OF_PERIODS)), group = to_string(get_int(0, NUM_OF_GROUPS));
+		inserts.push_back("insert teacher=" + tch + " subject=" + sbj + " room=" + room + " day=" + day +
+			" period=" + period + " group=" + group);
+		executes.push_back("execute 0 " + tch + " " + sbj + " " + room + " " + day + " " + period + " " + group);
+		removes.push_back("remove room=" + room + " day=" + day + " period=" + period);
+	}
+
+	/* Часть вставок упирается в накладки - это тоже рабочий путь insert. */
+	auto db = load();
+	run("insert", [&](size_t i) { db->process_query(1, inserts[i % inserts.size()]); });
+	run("remove_cell", [&](size_t i) { db->process_query(1, removes[i % removes.size()]); });
+
+	db = load();
+	db->process_query(1, "prepare insert teacher=? subject=? room=? day=? period=? group=?");
+	run("execute_insert", [&](size_t i) { db->process_query(1, executes[i % executes.size()]); });
+}
+
+void Bench::bench_find()
+{
+	auto db = load();
+	vector<string> by_teacher, by_range, by_prefix, by_group, by_mixed;
+	for (int i = 0; i < 256; ++i) {
+		by_teacher.push_back("select teacher=" + teacher(get_int(0, _teachers - 1)));
+		int room = get_int(0, NUM_OF_ROOMS - 100);
+		by_range.push_back("select day=" + to_string(get_int(1, NUM_OF_DAYS)) + " room=" +
+			to_string(room) + "-" + to_string(room + 100));
+		by_prefix.push_back("select teacher=T" + name(i % 26) + "* group=" + to_string(get_int(0, 300)) + "-*");
+		int group = get_int(0, NUM_OF_GROUPS - 10);
+		by_group.push_back("select group=" + to_string(group) + "-" + to_string(group + 10));
+		by_mixed.push_back("select subject=" + subject(i) + " teacher=T" + name(i % 26) + "* room=0-800 period=2-6");
+	}
+	/* find исполняется отложенно, при print, поэтому замеряется пара запросов. */
+	auto select_print = [&db](const string &select) {
+		db->process_query(1, select);
+		db->process_query(1, "print room day period");
+	};
+	run("find_teacher_index", [&](size_t i) { select_print(by_teacher[i % by_teacher.size()]); });
+	run("find_range_scan", [&](size_t i) { select_print(by_range[i % by_range.size()]); });
+	run("find_prefix_scan", [&](size_t i) { select_print(by_prefix[i % by_prefix.size()]); });
+	run("find_group_range", [&](size_t i) { select_print(by_group[i % by_group.size()]); });
+	run("find_index_filter", [&](size_t i) { select_print(by_mixed[i % by_mixed.size()]); });
+}
+
+void Bench::bench_print()
+{
+	auto db = load();
+	db->process_query(1, "select room=*-*");
+	run("print_all", [&](size_t) { db->process_query(1, "print teacher subject room day period group"); });
+	run("print_all_sorted", [&](size_t) {
+		db->process_query(1, "print teacher subject room day period group sort teacher day period");
+	});
+}
+
+void Bench::bench_files()
+{
+	run("from_file", [&](size_t) { load(); });
+	auto db = load();
+	string out = _data_file + ".out";
+	run("to_file", [&](size_t) { db->to_file(out); });
+	filesystem::remove(out);
+}
+
+void Bench::bench_hashtable()
+{
+	vector<string> keys;
+	for (size_t i = 0; i < 1 << 14; ++i)
+		keys.push_back(teacher(i) + name(i));
+	HashTable<string, int> ht;
+	run("hashtable_insert", [&](size_t i) { ht[keys[i % keys.size()]] = i; });
+	run("hashtable_find", [&](size_t i) { ht.find(keys[i % keys.size()]); });
+	run("hashtable_erase", [&](size_t i) {
+		const string &key = keys[i % keys.size()];
+		if (ht.erase(key) == 0)
+			ht[key] = i;	// ключи закончились - возвращаем на место, чтобы было что удалять
+	});
+}
+
+void Bench::run_all()
+{
+	bench_parse();
+	bench_insert_remove();
+	bench_find();
+	bench_print();
+	bench_files();
+	bench_hashtable();
+}
+
+void Bench::write_csv(ostream &os, const vector<BenchResult> &results)
+{
+	os << "scenario,ops,ns_per_op,ops_per_sec\n";
+	for (const BenchResult &r : results)
+		os << r.scenario << ',' << r.ops << ',' << r.ns_per_op << ',' << r.ops_per_sec << '\n';
+}
+
+void Bench::write_json(ostream &os, const vector<BenchResult> &results)
+{
+	os << "[\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchResult &r = results[i];
+		os << "  {\"scenario\": \"" << r.scenario << "\", \"ops\": " << r.ops << ", \"ns_per_op\": "
+		   << r.ns_per_op << ", \"ops_per_sec\": " << r.ops_per_sec << '}'
+		   << (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	os << "]\n";
+}
+
+map<string, double> Bench::read_baseline(const string &filename)
+{
+	ifstream in(filename);
+	if (!in.is_open())
+		throw runtime_error("Cannot open the baseline file!");
+	map<string, double> baseline;
+	string line;
+	getline(in, line); // заголовок
+	while (getline(in, line)) {
+		stringstream ss(line);
+		string scenario, ops, ns;
+		if (getline(ss, scenario, ',') && getline(ss, ops, ',') && getline(ss, ns, ','))
+			baseline[scenario] = stod(ns);
+	}
+	return baseline;
+}
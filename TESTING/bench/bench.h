@@ -0,0 +1,66 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include "../../Database/database.h"
+
+/* Результат одного сценария. */
+struct BenchResult
+{
+	std::string scenario;
+	size_t ops;
+	double ns_per_op;
+	double ops_per_sec;
+};
+
+/*
+ * Микробенчмарки горячих путей базы данных: Database вызывается напрямую, без сервера и сокетов.
+ * Каждый сценарий повторяется, пока не наберётся min_time_ms миллисекунд.
+ */
+class Bench
+{
+  private:
+	double _fill;			// доля занятых ячеек расписания в синтетических данных
+	size_t _teachers;		// количество различных преподавателей
+	int _min_time_ms;
+	std::mt19937 _rng;
+	std::string _data_file;	// синтетические данные в формате data.txt
+	size_t _records;		// сколько записей реально попало в базу (без накладок)
+	std::vector<BenchResult> _results;
+
+	static std::string name(size_t id);
+	std::string teacher(size_t id) const { return "T" + name(id % _teachers); }
+	static std::string subject(size_t id) { return "S" + name(id % 32); }
+	int get_int(int min, int max) { return std::uniform_int_distribution<int>(min, max)(_rng); }
+
+	std::unique_ptr<Database> load() const;
+	/* Запускает body(i) для i = 0, 1, ..., пока не пройдёт min_time_ms, и запоминает результат. */
+	void run(const std::string &scenario, const std::function<void(size_t)> &body);
+
+	void bench_parse();
+	void bench_insert_remove();
+	void bench_find();
+	void bench_print();
+	void bench_files();
+	void bench_hashtable();
+
+  public:
+	Bench(double fill, size_t teachers, int min_time_ms, unsigned seed);
+	~Bench();
+	size_t records() const { return _records; }
+	void run_all();
+	const std::vector<BenchResult>& results() const { return _results; }
+
+	static void write_csv(std::ostream &os, const std::vector<BenchResult> &results);
+	static void write_json(std::ostream &os, const std::vector<BenchResult> &results);
+	static std::map<std::string, double> read_baseline(const std::string &filename);
+};
+
+#endif // BENCH_H
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include "bench.h"
+
+using namespace std;
+
+static void usage()
+{
+	cerr << "Usage: bench [--fill F] [--teachers N] [--time-ms MS] [--seed S]\n"
+		 << "             [--format csv|json] [--out FILE] [--baseline FILE] [--threshold PCT]\n";
+}
+
+int main(int argc, char **argv)
+{
+	double fill = 0.3, threshold = 10;
+	size_t teachers = 2000;
+	int time_ms = 200;
+	unsigned seed = 42;
+	string format = "csv", out_file, baseline_file;
+
+	for (int i = 1; i < argc; ++i) {
+		if (i + 1 >= argc) {
+			usage();
+			return 2;
+		}
+		const char *opt = argv[i], *val = argv[++i];
+		try {
+			if (!strcmp(opt, "--fill"))
+				fill = stod(val);
+			else if (!strcmp(opt, "--teachers"))
+				teachers = stoul(val);
+			else if (!strcmp(opt, "--time-ms"))
+				time_ms = stoi(val);
+			else if (!strcmp(opt, "--seed"))
+				seed = stoul(val);
+			else if (!strcmp(opt, "--format"))
+				format = val;
+			else if (!strcmp(opt, "--out"))
+				out_file = val;
+			else if (!strcmp(opt, "--baseline"))
+				baseline_file = val;
+			else if (!strcmp(opt, "--threshold"))
+				threshold = stod(val);
+			else
+				throw invalid_argument(opt);
+		} catch (const logic_error &) {
+			usage();
+			return 2;
+		}
+	}
+	if ((format != "csv" && format != "json") || fill < 0 || fill > 1 || teachers == 0) {
+		usage();
+		return 2;
+	}
+
+	try {
+		Bench bench(fill, teachers, time_ms, seed);
+		cerr << "Records in the database: " << bench.records() << "\n";
+		bench.run_all();
+
+		ofstream file;
+		if (!out_file.empty()) {
+			file.open(out_file);
+			if (!file.is_open())
+				throw runtime_error("Cannot open the output file!");
+		}
+		ostream &out = out_file.empty() ? cout : file;
+		if (format == "csv")
+			Bench::write_csv(out, bench.results());
+		else
+			Bench::write_json(out, bench.results());
+
+		if (baseline_file.empty())
+			return 0;
+
+		/* Сценарий считается деградировавшим, если стал медленнее базового более чем на threshold процентов. */
+		auto baseline = Bench::read_baseline(baseline_file);
+		int regressions = 0;
+		for (const BenchResult &r : bench.results()) {
+			auto it = baseline.find(r.scenario);
+			if (it == baseline.end())
+				continue;
+			double change = (r.ns_per_op / it->second - 1) * 100;
+			if (change > threshold) {
+				cerr << "REGRESSION " << r.scenario << ": " << it->second << " -> " << r.ns_per_op
+					 << " ns/op (+" << change << "%)\n";
+				++regressions;
+			}
+		}
+		cerr << (regressions ? "Regressions found: " : "No regressions, checked against ")
+			 << (regressions ? to_string(regressions) : baseline_file) << "\n";
+		return regressions ? 1 : 0;
+	} catch (const exception &e) {
+		cerr << e.what() << "\n";
+		return 2;
+	}
+}
@@ -0,0 +1,27 @@
+#ifndef LOADGEN_EXC_H
+#define LOADGEN_EXC_H
+
+#include <exception>
+
+class LoadGenExc : public std::exception
+{
+	const char *msg;
+
+public:
+	LoadGenExc(const char *msg) : msg(msg) {}
+	virtual const char *what() const noexcept override { return msg; }
+};
+
+class LoadGenExcConnect : public LoadGenExc
+{
+public:
+	LoadGenExcConnect(const char *msg) : LoadGenExc(msg) {}
+};
+
+class LoadGenExcProtocol : public LoadGenExc
+{
+public:
+	LoadGenExcProtocol(const char *msg) : LoadGenExc(msg) {}
+};
+
+#endif // LOADGEN_EXC_H
@@ -0,0 +1,57 @@
+#include <bit>
+#include <cmath>
+#include <algorithm>
+#include "histogram.h"
+
+using namespace std;
+
+Histogram::Histogram() :
+	_counts(SUB_COUNT + (64 - SUB_BITS) * HALF_COUNT, 0), _total(0), _max(0)
+{}
+
+size_t Histogram::index(uint64_t value)
+{
+	if (value < SUB_COUNT)
+		return value;
+	int shift = bit_width(value) - SUB_BITS;
+	return SUB_COUNT + (shift - 1) * HALF_COUNT + ((value >> shift) - HALF_COUNT);
+}
+
+uint64_t Histogram::upper(size_t index)
+{
+	if (index < SUB_COUNT)
+		return index;
+	index -= SUB_COUNT;
+	int shift = index / HALF_COUNT + 1;
+	uint64_t mantissa = index % HALF_COUNT + HALF_COUNT;
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value)
+{
+	++_counts[index(value)];
+	++_total;
+	_max = std::max(_max, value);
+}
+
+void Histogram::merge(const Histogram &other)
+{
+	for (size_t i = 0; i < _counts.size(); ++i)
+		_counts[i] += other._counts[i];
+	_total += other._total;
+	_max = std::max(_max, other._max);
+}
+
+uint64_t Histogram::percentile(double percent) const
+{
+	if (_total == 0)
+		return 0;
+	uint64_t rank = std::max<uint64_t>(1, ceil(percent / 100 * _total));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < _counts.size(); ++i) {
+		seen += _counts[i];
+		if (seen >= rank)
+			return std::min(upper(i), _max);
+	}
+	return _max;
+}
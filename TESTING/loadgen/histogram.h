@@ -0,0 +1,38 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Гистограмма задержек в духе HdrHistogram: до 128 нс значения хранятся точно, дальше каждый
+ * интервал [2^k, 2^(k+1)) делится на 64 равные части, т.е. относительная погрешность меньше 1.6%
+ * при постоянном объёме памяти и O(1) на запись.
+ */
+class Histogram
+{
+  private:
+	static constexpr int SUB_BITS = 7;
+	static constexpr uint64_t SUB_COUNT = 1 << SUB_BITS;
+	static constexpr uint64_t HALF_COUNT = SUB_COUNT / 2;
+
+	std::vector<uint64_t> _counts;
+	uint64_t _total;
+	uint64_t _max;
+
+	static size_t index(uint64_t value);
+	/* Верхняя граница значений, попадающих в корзину. */
+	static uint64_t upper(size_t index);
+
+  public:
+	Histogram();
+	void record(uint64_t value);
+	void merge(const Histogram &other);
+	uint64_t total() const { return _total; }
+	uint64_t max() const { return _max; }
+	/* Значение, не меньше которого percent процентов записанных. */
+	uint64_t percentile(double percent) const;
+};
+
+#endif // HISTOGRAM_H
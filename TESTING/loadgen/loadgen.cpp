@@ -0,0 +1,236 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <thread>
+#include <iomanip>
+#include <cctype>
+#include <cstring>
+#include "loadgen.h"
+#include "../../TaskStructures/task_structures.h"
+
+using namespace std;
+
+LoadGen::LoadGen(const vector<string> &queries, const LoadOptions &options) :
+	_queries(queries), _options(options), _elapsed(0)
+{
+	if (_options.requests == 0)
+		_options.requests = _queries.size();
+	if (_queries.empty() || _options.connections == 0)
+		throw LoadGenExc("Nothing to send!");
+}
+
+int LoadGen::connect_to(const LoadOptions &options)
+{
+	if (!options.unix_path.empty()) {
+		sockaddr_un addr{};
+		if (options.unix_path.size() >= sizeof(addr.sun_path))
+			throw LoadGenExcConnect("The socket path is too long!");
+		addr.sun_family = AF_UNIX;
+		memcpy(addr.sun_path, options.unix_path.c_str(), options.unix_path.size() + 1);
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+			if (fd >= 0)
+				close(fd);
+			throw LoadGenExcConnect("Cannot connect to the server!");
+		}
+		return fd;
+	}
+
+	const string &host = options.host;
+	int port = options.port;
+	addrinfo hints{}, *res;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &res) != 0)
+		throw LoadGenExcConnect("Cannot resolve the server address!");
+	int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+		freeaddrinfo(res);
+		if (fd >= 0)
+			close(fd);
+		throw LoadGenExcConnect("Cannot connect to the server!");
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static void send_all(int fd, const void *data, size_t len)
+{
+	const char *ptr = static_cast<const char*>(data);
+	while (len > 0) {
+		ssize_t n = send(fd, ptr, len, MSG_NOSIGNAL);
+		if (n <= 0)
+			throw LoadGenExcProtocol("Cannot send the query!");
+		ptr += n, len -= n;
+	}
+}
+
+static void recv_all(int fd, void *data, size_t len)
+{
+	if (len > 0 && recv(fd, data, len, MSG_WAITALL) != ssize_t(len))
+		throw LoadGenExcProtocol("The server closed the connection!");
+}
+
+static int recv_int(int fd)
+{
+	int value;
+	recv_all(fd, &value, sizeof(value));
+	return value;
+}
+
+void LoadGen::send_query(int fd, string_view query)
+{
+	/* Длина и текст уходят одним send(), иначе второй пакет ждёт подтверждения первого (Нейгл). */
+	static thread_local string buffer;
+	int len = query.size();
+	buffer.assign(reinterpret_cast<const char*>(&len), sizeof(len));
+	buffer.append(query);
+	send_all(fd, buffer.data(), buffer.size());
+}
+
+int LoadGen::recv_answer(int fd, ShmRing *ring)
+{
+	static thread_local string buffer;	// содержимое ответа не нужно, только его длина
+	if (ring != nullptr && ring->receive(buffer)) {
+		int code;
+		if (buffer.size() < sizeof(code))
+			throw LoadGenExcProtocol("Broken answer in the shared memory!");
+		memcpy(&code, buffer.data(), sizeof(code));
+		return code;
+	}
+	int code = recv_int(fd);
+	switch (code) {
+		case SUCCESS:
+		case QUIT:
+			break;
+		case PRINT_DATA:
+			for (int n = recv_int(fd); n > 0; --n) {
+				buffer.resize(recv_int(fd));
+				recv_all(fd, buffer.data(), buffer.size());
+			}
+			break;
+		case ERROR:
+			buffer.resize(recv_int(fd));
+			recv_all(fd, buffer.data(), buffer.size());
+			break;
+		case PREPARED:
+			recv_int(fd);
+			break;
+		default:
+			throw LoadGenExcProtocol("Unknown answer code!");
+	}
+	return code;
+}
+
+string LoadGen::command(string_view query)
+{
+	string cmd;
+	for (char c : query.substr(0, query.find(' ')))
+		cmd += tolower(c);
+	return cmd;
+}
+
+void LoadGen::worker(size_t conn, Clock::time_point start, Stats &stats) const
+{
+	int fd;
+	unique_ptr<ShmRing> ring;
+	try {
+		fd = connect_to(_options);
+	} catch (const LoadGenExc &e) {
+		stats.failure = e.what();
+		return;
+	}
+	try {
+		if (_options.shm)
+			ring = ShmRing::negotiate(fd);
+	} catch (const TransportExc &e) {
+		stats.failure = e.what();
+		close(fd);
+		return;
+	}
+	try {
+		for (size_t i = conn; i < _options.requests; i += _options.connections) {
+			const string &query = _queries[i % _queries.size()];
+			Clock::time_point sent;
+			if (_options.rate > 0) {
+				sent = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(i / _options.rate));
+				this_thread::sleep_until(sent);
+			} else {
+				sent = Clock::now();
+			}
+			send_query(fd, query);
+			int code = recv_answer(fd, ring.get());
+			uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - sent).count();
+			string cmd = command(query);
+			stats.latency[cmd].record(ns);
+			if (code == ERROR)
+				++stats.errors[cmd];
+			else if (code == QUIT)
+				throw LoadGenExcProtocol("The server ended the session!");
+		}
+		send_query(fd, "stop");
+		recv_answer(fd, ring.get());
+	} catch (const LoadGenExc &e) {
+		stats.failure = e.what();
+	} catch (const TransportExc &e) {
+		stats.failure = e.what();
+	}
+	close(fd);
+}
+
+void LoadGen::run()
+{
+	vector<Stats> stats(_options.connections);
+	vector<thread> threads;
+	auto start = Clock::now();
+	for (size_t c = 0; c < _options.connections; ++c)
+		threads.emplace_back(&LoadGen::worker, this, c, start, ref(stats[c]));
+	for (thread &t : threads)
+		t.join();
+	_elapsed = Clock::now() - start;
+
+	for (const Stats &s : stats) {
+		for (const auto &[cmd, hist] : s.latency)
+			_total.latency[cmd].merge(hist);
+		for (const auto &[cmd, n] : s.errors)
+			_total.errors[cmd] += n;
+		if (!s.failure.empty() && _total.failure.empty())
+			_total.failure = s.failure;
+	}
+}
+
+void LoadGen::report(ostream &os) const
+{
+	double seconds = chrono::duration<double>(_elapsed).count();
+	Histogram all;
+	size_t errors = 0;
+	for (const auto &[cmd, hist] : _total.latency)
+		all.merge(hist);
+	for (const auto &[cmd, n] : _total.errors)
+		errors += n;
+
+	os << "Connections: " << _options.connections << " over "
+	   << (_options.unix_path.empty() ? "TCP" : _options.shm ? "Unix socket + shared memory" : "Unix socket") << ", mode: "
+	   << (_options.rate > 0 ? "open loop at " + to_string(int(_options.rate)) + " req/s" : string("closed loop"))
+	   << "\nRequests: " << all.total() << ", errors: " << errors << ", time: " << fixed << setprecision(3)
+	   << seconds << " s, throughput: " << setprecision(0) << all.total() / seconds << " req/s\n";
+	if (!_total.failure.empty())
+		os << "Some connections stopped early: " << _total.failure << "\n";
+
+	os << "\nLatency in microseconds\n" << left << setw(10) << "command" << right << setw(10) << "count"
+	   << setw(8) << "errors" << setw(10) << "req/s" << setw(12) << "p50" << setw(12) << "p90"
+	   << setw(12) << "p99" << setw(12) << "p999" << setw(12) << "max" << "\n";
+	auto row = [&](const string &name, const Histogram &h, size_t errs) {
+		os << left << setw(10) << name << right << setw(10) << h.total() << setw(8) << errs
+		   << setw(10) << setprecision(0) << h.total() / seconds << setprecision(1);
+		for (double p : {50.0, 90.0, 99.0, 99.9})
+			os << setw(12) << h.percentile(p) / 1000.0;
+		os << setw(12) << h.max() / 1000.0 << "\n";
+	};
+	for (const auto &[cmd, hist] : _total.latency) {
+		auto it = _total.errors.find(cmd);
+		row(cmd, hist, it == _total.errors.end() ? 0 : it->second);
+	}
+	row("all", all, errors);
+}
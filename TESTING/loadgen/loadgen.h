@@ -0,0 +1,65 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <ostream>
+#include "histogram.h"
+#include "LoadGenExc.h"
+#include "../../Transport/shm_ring.h"
+
+struct LoadOptions
+{
+	std::string host = "localhost";
+	int port = 5555;
+	std::string unix_path;	// подключаться через Unix-сокет сервера вместо TCP
+	bool shm = false;		// ... и получать ответы через общую память
+	size_t connections = 4;
+	size_t requests = 0;	// сколько запросов отправить (0 - весь сценарий один раз)
+	double rate = 0;		// суммарная целевая частота запросов в секунду (0 - замкнутый цикл)
+};
+
+/*
+ * Нагрузочный генератор: открывает несколько соединений с сервером и раздаёт им запросы сценария
+ * по кругу (i-й запрос уходит в соединение i % connections).
+ * В замкнутом цикле каждое соединение отправляет следующий запрос сразу после ответа на предыдущий.
+ * В открытом цикле i-й запрос должен уйти в момент i / rate, и задержка считается от этого момента,
+ * так что очередь, накопившаяся на медленном сервере, тоже попадает в статистику.
+ */
+class LoadGen
+{
+  private:
+	using Clock = std::chrono::steady_clock;
+
+	/* Статистика одного соединения; объединяется после завершения потоков. */
+	struct Stats
+	{
+		std::map<std::string, Histogram> latency;	// по командам, в наносекундах
+		std::map<std::string, size_t> errors;		// ответы с кодом ERROR
+		std::string failure;						// почему соединение прервалось раньше времени
+	};
+
+	const std::vector<std::string> &_queries;
+	LoadOptions _options;
+	Stats _total;
+	Clock::duration _elapsed;
+
+	static int connect_to(const LoadOptions &options);
+	static void send_query(int fd, std::string_view query);
+	/* Принимает ответ целиком (из кольца ring, если оно есть) и возвращает его код. */
+	static int recv_answer(int fd, ShmRing *ring);
+	static std::string command(std::string_view query);
+
+	void worker(size_t conn, Clock::time_point start, Stats &stats) const;
+
+  public:
+	LoadGen(const std::vector<std::string> &queries, const LoadOptions &options);
+	void run();
+	void report(std::ostream &os) const;
+};
+
+#endif // LOADGEN_H
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include "loadgen.h"
+#include "../generator/generator.h"
+
+using namespace std;
+
+static void usage()
+{
+	cerr << "Usage: loadgen [--host HOST] [--port PORT | --unix SOCKET | --shm SOCKET] [--connections N]\n"
+		 << "               [--rate REQ_PER_SEC]"
+		 << " [--requests N] [--workload FILE | --generate insert|mix [--count N]]\n";
+}
+
+/* Сценарий из файла: по запросу в строке, stop и shutdown пропускаются. */
+static vector<string> read_workload(const string &filename)
+{
+	ifstream in(filename);
+	if (!in.is_open())
+		throw LoadGenExc("Cannot open the workload file!");
+	vector<string> queries;
+	string line;
+	while (getline(in, line)) {
+		if (line.empty() || line == "stop" || line == "shutdown")
+			continue;
+		queries.push_back(line);
+	}
+	return queries;
+}
+
+int main(int argc, char **argv)
+{
+	LoadOptions options;
+	string workload, generate = "mix";
+	size_t count = 10000;
+
+	for (int i = 1; i < argc; ++i) {
+		if (i + 1 >= argc) {
+			usage();
+			return 2;
+		}
+		const char *opt = argv[i], *val = argv[++i];
+		try {
+			if (!strcmp(opt, "--host"))
+				options.host = val;
+			else if (!strcmp(opt, "--port"))
+				options.port = stoi(val);
+			else if (!strcmp(opt, "--unix") || !strcmp(opt, "--shm")) {
+				options.unix_path = val;
+				options.shm = !strcmp(opt, "--shm");
+			}
+			else if (!strcmp(opt, "--connections"))
+				options.connections = stoul(val);
+			else if (!strcmp(opt, "--rate"))
+				options.rate = stod(val);
+			else if (!strcmp(opt, "--requests"))
+				options.requests = stoul(val);
+			else if (!strcmp(opt, "--workload"))
+				workload = val;
+			else if (!strcmp(opt, "--generate"))
+				generate = val;
+			else if (!strcmp(opt, "--count"))
+				count = stoul(val);
+			else
+				throw invalid_argument(opt);
+		} catch (const logic_error &) {
+			usage();
+			return 2;
+		}
+	}
+	if (generate != "insert" && generate != "mix") {
+		usage();
+		return 2;
+	}
+
+	try {
+		vector<string> queries;
+		if (!workload.empty()) {
+			queries = read_workload(workload);
+		} else {
+			Generator gen("../generator/info/teachers.txt", "../generator/info/subjects.txt");
+			queries = generate == "insert" ? gen.get_insert(count) : gen.get_mix(count);
+		}
+		LoadGen load(queries, options);
+		load.run();
+		load.report(cout);
+	} catch (const exception &e) {
+		cerr << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
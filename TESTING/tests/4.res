@@ -0,0 +1,32 @@
+Welcome!
+
+>> 	Your query was processed successfully!
+>> 	Your query was prepared with handle 0
+>> 	Your query was processed successfully!
+>> 	The room is occupied at this time!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Too few values for the prepared query!
+>> 	Invalid field format!
+>> 	Your query was prepared with handle 1
+>> 	The teacher is busy at this time!
+>> 	Your query was processed successfully!
+>> 	The following information was found for your query:
+
+	Bray; 2; 2; 
+>> 	Your query was processed successfully!
+>> 	The following information was found for your query:
+
+	Roberson; 1; 1; 
+>> 	Your query was prepared with handle 2
+>> 	Your query was processed successfully!
+>> 	No such prepared query!
+>> 	Only 'insert', 'remove', 'select' and 'reselect' can be prepared!
+>> 	All fields must be set!
+>> 	Your query was processed successfully!
+>> 	The following information was found for your query:
+
+	Roberson; Trigonometry; 1; 2; 1; 1; 
+	Bray; Calculus; 2; 2; 2; 1; 
+>> 
+Goodbye!
@@ -0,0 +1,54 @@
+Welcome!
+
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	The following information was found for your query:
+
+	5; 
+>> 	The following information was found for your query:
+
+	2; 
+>> 	The following information was found for your query:
+
+	3; 
+>> 	The following information was found for your query:
+
+	0; 
+>> 	The following information was found for your query:
+
+	Bray; 2; 
+	Roberson; 2; 
+	Saunders; 1; 
+>> 	The following information was found for your query:
+
+	1; 2; 
+	2; 2; 
+>> 	The following information was found for your query:
+
+	Calculus; 1; 3; 2; 
+	Topology; 3; 1; 5; 
+	Trigonometry; 1; 1; 1; 
+>> 	The following information was found for your query:
+
+	4; 1; 
+>> 	The following information was found for your query:
+
+	1; Roberson; 2; 
+>> 	The following information was found for your query:
+
+	0; 
+>> 	The following information was found for your query:
+
+	0; ; ; 
+>> 	The following information was found for your query:
+
+>> 	'min' and 'max' apply to numeric fields only!
+>> 	Specify at least one of 'count', 'min' or 'max'!
+>> 	Conditions must precede 'by' and aggregates!
+>> 	Specify fields after 'by'!
+>> 
+Goodbye!
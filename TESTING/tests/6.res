@@ -0,0 +1,31 @@
+Welcome!
+
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	The following information was found for your query:
+
+	1; 1; 2; 
+	1; 1; 3; 
+	1; 2; 1; 
+	1; 2; 3; 
+	1; 3; 1; 
+	1; 3; 2; 
+	1; 4; 1; 
+	1; 4; 2; 
+	1; 4; 3; 
+>> 	The following information was found for your query:
+
+	1; 4; 1; 
+	1; 4; 2; 
+	1; 4; 3; 
+>> 	The following information was found for your query:
+
+	1; 4; 1; 
+	1; 4; 2; 
+>> 	Subject can't be used in 'free'!
+>> 	Teacher and group must be set exactly!
+>> 	Limit must be a positive number!
+>> 
+Goodbye!
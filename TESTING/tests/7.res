@@ -0,0 +1,25 @@
+Welcome!
+
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	The following information was found for your query:
+
+	Ross; Algebra; 3; 1; 3; 
+	Ross; Calculus; 4; 2; 1; 
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	The following information was found for your query:
+
+	Bray; 1; 1; 1; 
+>> 	Your query was processed successfully!
+>> 	Your query was processed successfully!
+>> 	The following information was found for your query:
+
+>> 	'truncate' command must be one word!
+>> 
+Goodbye!
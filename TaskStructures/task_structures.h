@@ -5,7 +5,9 @@
 #define NUM_OF_PERIODS 7		// максимальное количество пар в день
 #define NUM_OF_DAYS 7			// количество дней
 #define NUM_OF_GROUPS 699		// максимальный номер группы
+#define ROOM_BITS 10			// младшие биты упакованной позиции, отведённые под аудиторию
 
+#include <cstdint>
 #include <string>
 #include <map>
 #include <sstream>
@@ -32,14 +34,16 @@ typedef enum
 	SUCCESS = 0,	// Была выполнена одна из команд insert, remove, select, reselect
 	PRINT_DATA = 1,	// Была выполнена команда print, нужно принять данные
 	QUIT = 2,		// Была выполнена команда stop или shutdown, нужно прекратить работу
-	ERROR = 3		// Возникла ошибка
+	ERROR = 3,		// Возникла ошибка
+	PREPARED = 4	// Была выполнена команда prepare, нужно принять номер запроса
 } ProtocolCode;
 
 typedef enum
 {
 	SEND_INFO,			// Отослать данные
 	DISCONNECT_USER,	// Отключить клиента
-	SERVER_SHUTDOWN		// Прекратить работу сервера
+	SERVER_SHUTDOWN,	// Прекратить работу сервера
+	ANSWER_LATER		// Ответ будет готов позже (см. Database::finished), до тех пор не читать запросы клиента
 } ServerCode;
 
 /* Виды отношений в условных запросах. */
@@ -107,4 +111,27 @@ struct SchedulePosition
 	bool operator==(const SchedulePosition &other) const;
 };
 
+/*
+ * Та же позиция в двух байтах: время в старших битах, аудитория в младших. В таком виде позиции
+ * хранятся в списках индексов и в найденном поиском, и в строку кэша их помещается вчетверо больше.
+ */
+class PackedPosition
+{
+  private:
+	uint16_t _code;
+
+  public:
+	PackedPosition() {}
+	PackedPosition(const SchedulePosition &pos) : _code(uint16_t(pos.timecode << ROOM_BITS | pos.room)) {}
+	operator SchedulePosition() const {
+		SchedulePosition pos;
+		pos.timecode = _code >> ROOM_BITS;
+		pos.room = _code & ((1 << ROOM_BITS) - 1);
+		return pos;
+	}
+	bool operator==(const PackedPosition &other) const { return _code == other._code; }
+};
+static_assert(NUM_OF_ROOMS < (1 << ROOM_BITS) && (NUM_OF_DAYS * NUM_OF_PERIODS << ROOM_BITS) <= (1 << 16),
+			  "A schedule position does not fit in 16 bits");
+
 #endif // TASK_STRUCTURES_H
@@ -0,0 +1,44 @@
+#include "thread_pool.h"
+
+void ThreadPool::run()
+{
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wakeup.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+			if (_tasks.empty())
+				return;
+			task = std::move(_tasks.front());
+			_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+ThreadPool::ThreadPool(size_t threads)
+{
+	_threads.reserve(threads);
+	for (size_t i = 0; i < threads; ++i)
+		_threads.emplace_back(&ThreadPool::run, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wakeup.notify_all();
+	for (std::thread &thread : _threads)
+		thread.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_tasks.push_back(std::move(task));
+	}
+	_wakeup.notify_one();
+}
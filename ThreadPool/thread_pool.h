@@ -0,0 +1,37 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Потоки, исполняющие задачи из общей очереди в порядке поступления. Задача не должна бросать
+ * исключения: сообщить об ошибке - её собственное дело.
+ */
+class ThreadPool
+{
+  private:
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _wakeup;
+	std::deque< std::function<void()> > _tasks;
+	bool _stopping = false;
+
+	void run();
+
+  public:
+	explicit ThreadPool(size_t threads);
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool& operator=(const ThreadPool &) = delete;
+	/* Дожидается исполнения всех поставленных задач. */
+	~ThreadPool();
+
+	size_t size() const { return _threads.size(); }
+	void submit(std::function<void()> task);
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,107 @@
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "trace.h"
+
+static const auto Started = std::chrono::steady_clock::now();
+
+uint64_t Trace::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Started).count();
+}
+
+#ifdef TRACING
+
+namespace {
+
+struct Event
+{
+	const char *name;
+	uint64_t start_ns;
+	uint64_t end_ns;
+};
+
+/* Кольцевой буфер одного потока: пишет только он сам, поэтому блокировки не нужны. */
+struct Buffer
+{
+	std::unique_ptr<Event[]> events{new Event[TRACE_BUFFER_SIZE]};
+	std::atomic<uint64_t> written{0};	// сколько событий записано за всё время
+	int tid;
+};
+
+std::mutex Buffers_Mutex;
+/* Переживают свои потоки и не удаляются вовсе: потоки глобальной базы пишут в них до самого выхода. */
+std::vector< std::unique_ptr<Buffer> > &Buffers = *new std::vector< std::unique_ptr<Buffer> >;
+
+Buffer& local_buffer()
+{
+	thread_local Buffer *buffer = nullptr;
+	if (buffer == nullptr) {
+		std::lock_guard<std::mutex> lock(Buffers_Mutex);
+		Buffers.push_back(std::make_unique<Buffer>());
+		buffer = Buffers.back().get();
+		buffer->tid = Buffers.size();
+	}
+	return *buffer;
+}
+
+} // namespace
+
+bool Trace::enabled()
+{
+	return true;
+}
+
+void Trace::record(const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+	Buffer &buffer = local_buffer();
+	uint64_t n = buffer.written.load(std::memory_order_relaxed);
+	buffer.events[n % TRACE_BUFFER_SIZE] = {name, start_ns, end_ns};
+	buffer.written.store(n + 1, std::memory_order_release);
+}
+
+/*
+ * События чужих потоков читаются без остановки этих потоков, поэтому самые старые из них могут
+ * оказаться уже перезаписанными новыми - для профилирования это допустимо.
+ */
+size_t Trace::dump(const std::string &filename)
+{
+	std::ofstream out(filename);
+	if (!out.is_open())
+		return 0;
+	size_t count = 0;
+	out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+	std::lock_guard<std::mutex> lock(Buffers_Mutex);
+	for (const auto &buffer : Buffers) {
+		uint64_t written = buffer->written.load(std::memory_order_acquire);
+		uint64_t first = written > TRACE_BUFFER_SIZE ? written - TRACE_BUFFER_SIZE : 0;
+		for (uint64_t i = first; i < written; ++i) {
+			const Event &e = buffer->events[i % TRACE_BUFFER_SIZE];
+			out << (count++ ? ",\n" : "") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+				<< buffer->tid << ",\"ts\":" << e.start_ns / 1000.0 << ",\"dur\":"
+				<< (e.end_ns - e.start_ns) / 1000.0 << "}";
+		}
+	}
+	out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+	return out.fail() ? 0 : count;
+}
+
+#else
+
+bool Trace::enabled()
+{
+	return false;
+}
+
+void Trace::record(const char *, uint64_t, uint64_t) {}
+
+size_t Trace::dump(const std::string &)
+{
+	return 0;
+}
+
+#endif // TRACING
@@ -0,0 +1,54 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <cstdint>
+
+#define TRACE_FILE "trace.json"			// куда команда trace выгружает события
+#define TRACE_BUFFER_SIZE (1 << 16)		// событий в кольцевом буфере одного потока
+
+/*
+ * Трассировка запросов: отрезки времени (span), помеченные в коде макросом TRACE_SPAN, копятся в
+ * кольцевых буферах потоков и по запросу выгружаются в формате Chrome Trace Event, который
+ * открывается в about://tracing и Perfetto.
+ * Трассировка включается при сборке (make TRACE=1, т.е. -DTRACING); без неё TRACE_SPAN не
+ * оставляет в коде ничего.
+ */
+class Trace
+{
+  public:
+	static bool enabled();
+	/* Наносекунды с момента запуска программы. */
+	static uint64_t now();
+	static void record(const char *name, uint64_t start_ns, uint64_t end_ns);
+	/* Записывает события всех потоков в filename и возвращает их количество. */
+	static size_t dump(const std::string &filename);
+};
+
+#ifdef TRACING
+
+/* Отрезок от создания объекта до выхода из области видимости; name должен жить вечно (литерал). */
+class TraceSpan
+{
+  private:
+	const char *_name;
+	uint64_t _start;
+
+  public:
+	explicit TraceSpan(const char *name) : _name(name), _start(Trace::now()) {}
+	TraceSpan(const TraceSpan &) = delete;
+	TraceSpan& operator=(const TraceSpan &) = delete;
+	~TraceSpan() { Trace::record(_name, _start, Trace::now()); }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+#else
+
+#define TRACE_SPAN(name) ((void)0)
+
+#endif // TRACING
+
+#endif // TRACE_H
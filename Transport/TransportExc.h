@@ -0,0 +1,23 @@
+#ifndef TRANSPORT_EXC_H
+#define TRANSPORT_EXC_H
+
+#include <exception>
+
+class TransportExc : public std::exception {
+	const char *msg;
+  public:
+	TransportExc(const char *msg) : msg(msg) {}
+	virtual const char *what() const noexcept override { return msg; }
+};
+
+class TransportExcSetup : public TransportExc {
+  public:
+	TransportExcSetup(const char *msg) : TransportExc(msg) {}
+};
+
+class TransportExcOverflow : public TransportExc {
+  public:
+	TransportExcOverflow(const char *msg) : TransportExc(msg) {}
+};
+
+#endif // TRANSPORT_EXC_H
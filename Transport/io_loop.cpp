@@ -0,0 +1,24 @@
+#include <iostream>
+#include "io_loop.h"
+#include "poll_loop.h"
+#include "uring_loop.h"
+
+std::string& IoLoop::Events::next_query(int fd)
+{
+	if (received == queries.size())
+		queries.emplace_back();
+	queries[received].first = fd;
+	return queries[received++].second;
+}
+
+std::unique_ptr<IoLoop> IoLoop::create(bool uring)
+{
+	if (uring) {
+		try {
+			return std::make_unique<UringLoop>();
+		} catch (const TransportExc &e) {
+			std::cout << e.what() << " Falling back to poll()." << std::endl;
+		}
+	}
+	return std::make_unique<PollLoop>();
+}
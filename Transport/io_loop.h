@@ -0,0 +1,60 @@
+#ifndef IO_LOOP_H
+#define IO_LOOP_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "TransportExc.h"
+
+/*
+ * Сетевой ввод-вывод сервера: ожидание событий, приём соединений, чтение запросов (по протоколу
+ * [длина][текст]) и отправка ответов. Слушающие сокеты и сокеты клиентов, переданные циклу, он же и
+ * закрывает; наблюдаемые дескрипторы (watch) остаются за их владельцами. От каждого клиента за одно
+ * ожидание приходит не больше одного запроса, а от клиента на паузе (pause) - ни одного.
+ */
+class IoLoop
+{
+  public:
+	/* Что произошло за одно ожидание; строки запросов переиспользуются между ожиданиями. */
+	struct Events {
+	  std::vector<int> ready;								// наблюдаемые дескрипторы, готовые к чтению
+	  std::vector<std::pair<int, int>> accepted;			// (слушающий сокет, новый клиент)
+	  std::vector<std::pair<int, std::string>> queries;	// (клиент, запрос), действительны первые received
+	  size_t received = 0;
+	  std::vector<int> broken;							// клиенты, соединение с которыми оборвалось
+
+	  void clear() { ready.clear(); accepted.clear(); received = 0; broken.clear(); }
+	  std::string& next_query(int fd);
+	};
+
+	virtual ~IoLoop() = default;
+
+	/* io_uring, если просили и ядро его поддерживает, иначе poll(). */
+	static std::unique_ptr<IoLoop> create(bool uring);
+	virtual const char* name() const = 0;
+
+	virtual void watch(int fd) = 0;
+	virtual void unwatch(int fd) = 0;
+	virtual void add_listener(int fd) = 0;
+	virtual void add_client(int fd) = 0;
+	/* Закрывает сокет клиента (io_uring - после того, как уйдут уже отправленные ему ответы). */
+	virtual void remove_client(int fd) = 0;
+	/*
+	 * Ждать ли запросов от клиента (пока готовится отложенный ответ - нет). Клиент на паузе не
+	 * попадает и в broken: о разрыве сервер узнает после паузы, когда отложенный ответ уже отдан.
+	 */
+	virtual void pause(int fd, bool listen) = 0;
+	size_t clients() const { return _clients; }
+
+	/* Ждёт событий не дольше timeout мс (-1 - бесконечно). */
+	virtual void wait(int timeout, Events &events) = 0;
+	/* Отправляет клиенту data; io_uring копирует её и отправляет при следующем wait(). */
+	virtual void send(int fd, std::string_view data) = 0;
+
+  protected:
+	size_t _clients = 0;
+};
+
+#endif // IO_LOOP_H
@@ -0,0 +1,136 @@
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include "poll_loop.h"
+#include "../Metrics/metrics.h"
+#include "../Trace/trace.h"
+
+/* -----------------------------------------PRIVATE METHODS-------------------------------------- */
+
+void PollLoop::add(int fd, Kind kind)
+{
+	_fds.push_back({fd, POLLIN, 0});
+	_kinds.push_back(kind);
+}
+
+void PollLoop::remove(size_t index)
+{
+	_fds[index] = _fds.back();
+	_kinds[index] = _kinds.back();
+	_fds.pop_back();
+	_kinds.pop_back();
+}
+
+size_t PollLoop::find(int fd, Kind kind) const
+{
+	for (size_t i = 0; i < _fds.size(); ++i)
+		if (real_fd(_fds[i]) == fd && _kinds[i] == kind)
+			return i;
+	return _fds.size();
+}
+
+bool PollLoop::read_query(int fd, std::string &query)
+{
+	TRACE_SPAN("read query");
+	int len;
+	Metrics::local().io_syscalls.add(2);
+	if (recv(fd, &len, sizeof(len), MSG_WAITALL) != sizeof(len) || len < 0) // считываем длину сообщения
+		return false;
+	query.resize(len);	// буфер переиспользуется между запросами
+	return recv(fd, query.data(), len, MSG_WAITALL) == len; // читаем сообщение целиком
+}
+
+/* ----------------------------------------PUBLIC METHODS---------------------------------------- */
+
+PollLoop::~PollLoop()
+{
+	for (size_t i = 0; i < _fds.size(); ++i)
+		if (_kinds[i] != WATCHED && close(real_fd(_fds[i])) < 0) // наблюдаемые закроют владельцы
+			perror("Server cannot close socket");
+}
+
+void PollLoop::unwatch(int fd)
+{
+	size_t i = find(fd, WATCHED);
+	if (i < _fds.size())
+		remove(i);
+}
+
+void PollLoop::add_client(int fd)
+{
+	add(fd, CLIENT);
+	++_clients;
+}
+
+void PollLoop::remove_client(int fd)
+{
+	size_t i = find(fd, CLIENT);
+	if (i == _fds.size())
+		return;
+	if (close(fd) < 0)
+		perror("Server cannot close socket");
+	remove(i);
+	--_clients;
+}
+
+/*
+ * POLLHUP и POLLERR poll() сообщает и без POLLIN в events, поэтому клиент на паузе не
+ * наблюдается вовсе (отрицательный дескриптор poll() пропускает): о разрыве соединения, пока
+ * готовится отложенный ответ, сервер узнает только после этого ответа.
+ */
+void PollLoop::pause(int fd, bool listen)
+{
+	size_t i = find(fd, CLIENT);
+	if (i < _fds.size())
+		_fds[i].fd = listen ? fd : -1 - fd;
+}
+
+void PollLoop::wait(int timeout, Events &events)
+{
+	events.clear();
+	Metrics::local().io_syscalls.add();
+	if (poll(_fds.data(), _fds.size(), timeout) < 0) { // ждём появления данных в каком-либо сокете
+		if (errno == EINTR)
+			return;
+		throw TransportExc("Server poll failure!");
+	}
+	for (size_t i = 0; i < _fds.size(); ++i) {
+		short revents = _fds[i].revents;
+		_fds[i].revents = 0;
+		if (revents == 0)
+			continue;
+		int fd = _fds[i].fd;
+		if (_kinds[i] == WATCHED) {
+			events.ready.push_back(fd);
+		} else if (_kinds[i] == LISTENER) {
+			/* Фактически отвечаем на команду connect от клиента. */
+			Metrics::local().io_syscalls.add();
+			int client = accept(fd, nullptr, nullptr);
+			if (client < 0)
+				throw TransportExc("Server accept failure!");
+			events.accepted.emplace_back(fd, client);
+		} else if (!(revents & POLLIN)) {
+			events.broken.push_back(fd);
+		} else if (!read_query(fd, events.next_query(fd))) {
+			--events.received;
+			events.broken.push_back(fd);
+		}
+	}
+}
+
+void PollLoop::send(int fd, std::string_view data)
+{
+	const char *ptr = data.data();
+	size_t left = data.size();
+	while (left > 0) {
+		Metrics::local().io_syscalls.add();
+		ssize_t sent = ::send(fd, ptr, left, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			throw TransportExc("Server cannot send data to client!");
+		ptr += sent;
+		left -= sent;
+	}
+}
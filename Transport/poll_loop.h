@@ -0,0 +1,41 @@
+#ifndef POLL_LOOP_H
+#define POLL_LOOP_H
+
+#include <sys/poll.h>
+#include "io_loop.h"
+
+/* Цикл на poll(): запрос читается и ответ отправляется блокирующими recv()/send(). */
+class PollLoop : public IoLoop
+{
+  private:
+	typedef enum { WATCHED, LISTENER, CLIENT } Kind;
+
+	std::vector<pollfd> _fds;
+	std::vector<Kind> _kinds;	// _kinds[i] - чем является _fds[i]
+
+	/* Дескриптор клиента на паузе хранится как -1 - fd. */
+	static int real_fd(const pollfd &p) { return p.fd < 0 ? -1 - p.fd : p.fd; }
+
+	void add(int fd, Kind kind);
+	void remove(size_t index);
+	size_t find(int fd, Kind kind) const;
+	static bool read_query(int fd, std::string &query);
+
+  public:
+	PollLoop() = default;
+	PollLoop(const PollLoop &) = delete;
+	PollLoop& operator=(const PollLoop &) = delete;
+	~PollLoop() override;
+
+	const char* name() const override { return "poll"; }
+	void watch(int fd) override { add(fd, WATCHED); }
+	void unwatch(int fd) override;
+	void add_listener(int fd) override { add(fd, LISTENER); }
+	void add_client(int fd) override;
+	void remove_client(int fd) override;
+	void pause(int fd, bool listen) override;
+	void wait(int timeout, Events &events) override;
+	void send(int fd, std::string_view data) override;
+};
+
+#endif // POLL_LOOP_H
@@ -0,0 +1,90 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include "../TaskStructures/task_structures.h"
+
+/*
+ * Формат обмена сервера с клиентами. Запрос - кадр: длина (int в порядке байт машины) и текст.
+ * Ответ начинается с кода ProtocolCode (int); за PRINT_DATA следуют число строк и по кадру на
+ * строку, за ERROR - кадр с текстом ошибки, за PREPARED - номер запроса (int).
+ */
+
+inline void put_int(std::string &buf, int number)
+{
+	buf.append(reinterpret_cast<const char*>(&number), sizeof(number));
+}
+
+inline void put_frame(std::string &buf, std::string_view data)
+{
+	put_int(buf, data.size());
+	buf.append(data);
+}
+
+/* Читает int с позиции pos и сдвигает её; false, если буфер кончился раньше. */
+inline bool get_int(std::string_view buf, size_t &pos, int &number)
+{
+	if (buf.size() - pos < sizeof(number))
+		return false;
+	std::memcpy(&number, buf.data() + pos, sizeof(number));
+	pos += sizeof(number);
+	return true;
+}
+
+/* Пропускает кадр с позиции pos; false, если он пришёл не целиком или длина отрицательна. */
+inline bool skip_frame(std::string_view buf, size_t &pos)
+{
+	size_t start = pos;
+	int len;
+	if (!get_int(buf, pos, len) || len < 0 || buf.size() - pos < size_t(len)) {
+		pos = start;
+		return false;
+	}
+	pos += len;
+	return true;
+}
+
+/* Размер кадра в начале buf вместе с длиной; 0 - кадр пришёл не целиком, -1 - длина отрицательна. */
+inline long frame_size(std::string_view buf)
+{
+	size_t pos = 0;
+	int len;
+	if (!get_int(buf, pos, len))
+		return 0;
+	if (len < 0)
+		return -1;
+	return buf.size() - pos >= size_t(len) ? long(pos) + len : 0;
+}
+
+/* Размер ответа в начале buf; 0 - ответ пришёл не целиком, -1 - неизвестный код или испорченный ответ. */
+inline long reply_size(std::string_view buf)
+{
+	size_t pos = 0;
+	int code, n;
+	if (!get_int(buf, pos, code))
+		return 0;
+	switch (code) {
+		case SUCCESS:
+		case QUIT:
+			return pos;
+		case PREPARED:
+			return get_int(buf, pos, n) ? long(pos) : 0;
+		case ERROR:
+			return skip_frame(buf, pos) ? long(pos) : frame_size(buf.substr(pos)) < 0 ? -1 : 0;
+		case PRINT_DATA:
+			if (!get_int(buf, pos, n))
+				return 0;
+			if (n < 0)
+				return -1;
+			for (; n > 0; --n)
+				if (!skip_frame(buf, pos))
+					return frame_size(buf.substr(pos)) < 0 ? -1 : 0;
+			return pos;
+		default:
+			return -1;
+	}
+}
+
+#endif // PROTOCOL_H
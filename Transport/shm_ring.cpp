@@ -0,0 +1,185 @@
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "shm_ring.h"
+#include "protocol.h"
+
+#define SHM_HEADER_SIZE 64	// заголовок занимает отдельную строку кэша перед данными
+
+static_assert(sizeof(std::atomic<uint64_t>) * 2 + sizeof(std::atomic<uint32_t>) <= SHM_HEADER_SIZE);
+
+/* -----------------------------------------PRIVATE METHODS-------------------------------------- */
+
+void ShmRing::map()
+{
+	void *mem = mmap(nullptr, SHM_HEADER_SIZE + SHM_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, _memfd, 0);
+	if (mem == MAP_FAILED)
+		throw TransportExcSetup("Transport: cannot map the shared memory!");
+	_header = static_cast<Header*>(mem);
+	_data = static_cast<char*>(mem) + SHM_HEADER_SIZE;
+}
+
+void ShmRing::copy_in(uint64_t at, const void *src, size_t len)
+{
+	size_t offset = at % SHM_RING_SIZE;
+	size_t first = std::min<size_t>(len, SHM_RING_SIZE - offset);
+	std::memcpy(_data + offset, src, first);
+	std::memcpy(_data, static_cast<const char*>(src) + first, len - first);
+}
+
+void ShmRing::copy_out(uint64_t at, void *dst, size_t len) const
+{
+	size_t offset = at % SHM_RING_SIZE;
+	size_t first = std::min<size_t>(len, SHM_RING_SIZE - offset);
+	std::memcpy(dst, _data + offset, first);
+	std::memcpy(static_cast<char*>(dst) + first, _data, len - first);
+}
+
+/* ----------------------------------------PUBLIC METHODS---------------------------------------- */
+
+/* Память memfd заполнена нулями, так что заголовок уже в начальном состоянии. */
+ShmRing::ShmRing()
+{
+	_memfd = memfd_create("schedule-ring", MFD_CLOEXEC);
+	if (_memfd < 0)
+		throw TransportExcSetup("Transport: cannot create the shared memory!");
+	_eventfd = eventfd(0, EFD_CLOEXEC);
+	if (_eventfd < 0 || ftruncate(_memfd, SHM_HEADER_SIZE + SHM_RING_SIZE) < 0) {
+		close(_memfd);
+		if (_eventfd >= 0)
+			close(_eventfd);
+		throw TransportExcSetup("Transport: cannot set up the shared memory!");
+	}
+	try {
+		map();
+	} catch (...) {
+		close(_memfd);
+		close(_eventfd);
+		throw;
+	}
+}
+
+ShmRing::ShmRing(int memfd, int eventfd) : _memfd(memfd), _eventfd(eventfd)
+{
+	try {
+		map();
+	} catch (...) {
+		close(_memfd);
+		close(_eventfd);
+		throw;
+	}
+}
+
+ShmRing::~ShmRing()
+{
+	munmap(_header, SHM_HEADER_SIZE + SHM_RING_SIZE);
+	close(_memfd);
+	close(_eventfd);
+}
+
+std::unique_ptr<ShmRing> ShmRing::offer(int sock)
+{
+	auto ring = std::make_unique<ShmRing>();
+	int code = 0; // SUCCESS
+	iovec iov{&code, sizeof(code)};
+	alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] = {};
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+	int fds[2] = {ring->_memfd, ring->_eventfd};
+	std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(code))
+		throw TransportExcSetup("Transport: cannot pass the shared memory to the client!");
+	return ring;
+}
+
+std::unique_ptr<ShmRing> ShmRing::negotiate(int sock)
+{
+	std::string hello;
+	put_frame(hello, SHM_HELLO);
+	if (send(sock, hello.data(), hello.size(), MSG_NOSIGNAL) != ssize_t(hello.size()))
+		throw TransportExcSetup("Transport: cannot ask the server for shared memory!");
+
+	int code = -1;
+	iovec iov{&code, sizeof(code)};
+	alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] = {};
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(code))
+		throw TransportExcSetup("Transport: the server closed the connection!");
+	cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (code != 0 || cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+		/* Сервер не знает SHM_HELLO (например, соединение по TCP) и ответил ошибкой - дочитываем её. */
+		int text_len;
+		if (recv(sock, &text_len, sizeof(text_len), MSG_WAITALL) == sizeof(text_len) && text_len > 0) {
+			std::string text(text_len, '\0');
+			recv(sock, text.data(), text_len, MSG_WAITALL);
+		}
+		throw TransportExcSetup("Transport: the server does not offer shared memory here!");
+	}
+	int fds[2];
+	std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	return std::make_unique<ShmRing>(fds[0], fds[1]);
+}
+
+/* Пока клиент спрашивает по одному запросу, кольцо к приходу ответа пусто. */
+bool ShmRing::post(std::string_view answer)
+{
+	uint64_t head = _header->head.load(std::memory_order_relaxed);
+	uint64_t space = SHM_RING_SIZE - (head - _header->tail.load(std::memory_order_acquire));
+	uint32_t len = answer.size();
+	if (space < sizeof(len))
+		throw TransportExcOverflow("Transport: the client does not read its answers!");
+	bool fits = answer.size() + sizeof(len) <= space;
+	if (!fits)
+		len = 0;
+	copy_in(head, &len, sizeof(len));
+	if (fits)
+		copy_in(head + sizeof(len), answer.data(), len);
+	_header->head.store(head + sizeof(len) + len, std::memory_order_seq_cst);
+	if (_header->sleeping.load(std::memory_order_seq_cst)) {
+		uint64_t one = 1;
+		if (write(_eventfd, &one, sizeof(one)) < 0)
+			throw TransportExcSetup("Transport: cannot wake the client!");
+	}
+	return fits;
+}
+
+bool ShmRing::receive(std::string &answer)
+{
+	uint64_t tail = _header->tail.load(std::memory_order_relaxed);
+	auto spin_until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(SHM_SPIN_NS);
+	while (_header->head.load(std::memory_order_acquire) == tail && std::chrono::steady_clock::now() < spin_until)
+		std::this_thread::yield();
+	while (_header->head.load(std::memory_order_acquire) == tail) {
+		_header->sleeping.store(1, std::memory_order_seq_cst);
+		if (_header->head.load(std::memory_order_seq_cst) != tail)
+			break;
+		uint64_t value;
+		if (read(_eventfd, &value, sizeof(value)) < 0 && errno != EINTR)
+			throw TransportExcSetup("Transport: cannot wait for the server!");
+	}
+	_header->sleeping.store(0, std::memory_order_relaxed);
+
+	uint32_t len;
+	copy_out(tail, &len, sizeof(len));
+	answer.resize(len);
+	copy_out(tail + sizeof(len), answer.data(), len);
+	_header->tail.store(tail + sizeof(len) + len, std::memory_order_release);
+	return len > 0;
+}
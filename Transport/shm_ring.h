@@ -0,0 +1,62 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "TransportExc.h"
+
+#define SHM_HELLO "#shm"					// первое сообщение клиента, который хочет ответы через общую память
+#define SHM_RING_SIZE (16 * 1024 * 1024)	// объём кольца; ответ длиннее уходит по сокету
+#define SHM_SPIN_NS 20000					// сколько клиент ждёт ответа активно, прежде чем уснуть на eventfd
+
+/*
+ * Кольцевой буфер в общей памяти для ответов сервера клиенту на той же машине. Сервер создаёт его
+ * (memfd) вместе с eventfd и передаёт оба дескриптора клиенту через Unix-сокет в ответ на SHM_HELLO.
+ * Каждый ответ лежит в кольце как [длина][байты ответа в формате протокола]; длина 0 означает, что
+ * ответ в кольцо не поместился и придёт по сокету как обычно. Запросы по-прежнему идут по сокету.
+ * Клиент ждёт ответ сначала активно, а затем, отметив в заголовке, что спит, - на eventfd; сервер
+ * пишет в eventfd только в этом случае, так что быстрый ответ обходится без системных вызовов.
+ */
+class ShmRing
+{
+  private:
+	struct Header {
+	  std::atomic<uint64_t> head;		// сколько байт записал сервер за всё время
+	  std::atomic<uint64_t> tail;		// сколько из них прочитал клиент
+	  std::atomic<uint32_t> sleeping;	// клиент ждёт на eventfd
+	};
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring header must be lock-free");
+
+	int _memfd;
+	int _eventfd;
+	Header *_header = nullptr;
+	char *_data = nullptr;
+
+	void map();
+	void copy_in(uint64_t at, const void *src, size_t len);
+	void copy_out(uint64_t at, void *dst, size_t len) const;
+
+  public:
+	/* Новое кольцо (на стороне сервера). */
+	ShmRing();
+	/* Кольцо, полученное от сервера (на стороне клиента); дескрипторы переходят во владение кольца. */
+	ShmRing(int memfd, int eventfd);
+	ShmRing(const ShmRing &) = delete;
+	ShmRing& operator=(const ShmRing &) = delete;
+	~ShmRing();
+
+	/* Сервер: создаёт кольцо для клиента, приславшего SHM_HELLO, и передаёт ему дескрипторы. */
+	static std::unique_ptr<ShmRing> offer(int sock);
+	/* Клиент: просит у сервера кольцо через Unix-сокет sock. */
+	static std::unique_ptr<ShmRing> negotiate(int sock);
+
+	/* Сервер: кладёт ответ в кольцо и при необходимости будит клиента; false - ответ надо отправить по сокету. */
+	bool post(std::string_view answer);
+	/* Клиент: дожидается очередного ответа; false - он придёт по сокету. */
+	bool receive(std::string &answer);
+};
+
+#endif // SHM_RING_H
@@ -0,0 +1,446 @@
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include "uring_loop.h"
+#include "protocol.h"
+#include "../Metrics/metrics.h"
+
+static int uring_setup(unsigned entries, io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned wait_nr, unsigned flags, const void *arg, size_t size)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, wait_nr, flags, arg, size);
+}
+
+static int uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* -----------------------------------------PRIVATE METHODS-------------------------------------- */
+
+io_uring_sqe* UringLoop::get_sqe(uint8_t opcode, int fd, uint64_t user_data)
+{
+	unsigned tail = *_sq_tail;
+	if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) == _sq_entries)
+		enter(0, 0); // очередь заполнена - отдаём накопленное ядру
+	unsigned index = tail & _sq_mask;
+	io_uring_sqe *sqe = &_sqes[index];
+	std::memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = user_data;
+	_sq_array[index] = index;
+	__atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++_to_submit;
+	return sqe;
+}
+
+void UringLoop::enter(unsigned wait_nr, int timeout)
+{
+	unsigned flags = 0;
+	__kernel_timespec ts;
+	io_uring_getevents_arg arg{};
+	if (wait_nr > 0) {
+		flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		if (timeout >= 0) {
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000LL;
+			arg.ts = reinterpret_cast<uint64_t>(&ts);
+		}
+	}
+	if (_to_submit == 0 && wait_nr == 0)
+		return;
+	Metrics::local().io_syscalls.add();
+	int submitted = uring_enter(_ring_fd, _to_submit, wait_nr, flags, &arg, sizeof(arg));
+	if (submitted < 0) {
+		if (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY)
+			return; // таймаут или ядру нужно сначала разобрать готовые результаты
+		throw TransportExc("Server io_uring failure!");
+	}
+	_to_submit -= std::min<unsigned>(submitted, _to_submit);
+}
+
+void UringLoop::arm()
+{
+	for (auto &[id, source] : _sources) {
+		if (source.armed || source.removed)
+			continue;
+		io_uring_sqe *sqe = get_sqe(source.op == OP_WATCH ? IORING_OP_POLL_ADD : IORING_OP_ACCEPT,
+									source.fd, tag(id, source.op));
+		if (source.op == OP_WATCH)
+			sqe->poll32_events = POLLIN;
+		source.armed = true;
+	}
+	for (auto &[id, conn] : _conns) {
+		if (conn.receiving || !conn.listening || conn.closing || conn.broken || query_size(conn) != 0)
+			continue;
+		if (conn.in.size() - conn.used < URING_RECV_CHUNK)
+			conn.in.resize(conn.used + URING_RECV_CHUNK);
+		io_uring_sqe *sqe = get_sqe(IORING_OP_RECV, conn.fd, tag(id, OP_RECV));
+		sqe->addr = reinterpret_cast<uint64_t>(conn.in.data() + conn.used);
+		sqe->len = conn.in.size() - conn.used;
+		conn.receiving = true;
+	}
+	for (uint64_t id : _dirty) {
+		auto it = _conns.find(id);
+		if (it == _conns.end())
+			continue;
+		Conn &conn = it->second;
+		if (conn.sending > 0 || conn.out.empty())
+			continue;
+		size_t n = std::min<size_t>(conn.out.size(), URING_MAX_CHAIN);
+		for (size_t k = 0; k < n; ++k) {
+			Out &out = conn.out[k];
+			io_uring_sqe *sqe;
+			if (out.buffer >= 0) {
+				sqe = get_sqe(IORING_OP_WRITE_FIXED, conn.fd, tag(id, OP_SEND));
+				sqe->addr = reinterpret_cast<uint64_t>(_buffers + size_t(out.buffer) * URING_SEND_BUFFER_SIZE + out.offset);
+				sqe->buf_index = out.buffer;
+				sqe->off = uint64_t(-1);
+			} else {
+				sqe = get_sqe(IORING_OP_SEND, conn.fd, tag(id, OP_SEND));
+				sqe->addr = reinterpret_cast<uint64_t>(out.heap.data() + out.offset);
+				sqe->msg_flags = MSG_NOSIGNAL;
+			}
+			sqe->len = out.len - out.offset;
+			if (k + 1 < n)
+				sqe->flags |= IOSQE_IO_LINK;
+		}
+		conn.sending = n;
+		conn.cursor = 0;
+	}
+	_dirty.clear();
+}
+
+void UringLoop::reap(Events &events)
+{
+	unsigned head = *_cq_head;
+	for (; head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE); ++head) {
+		const io_uring_cqe &cqe = _cqes[head & _cq_mask];
+		uint64_t id = cqe.user_data >> 3;
+		Op op = Op(cqe.user_data & 7);
+		int res = cqe.res;
+		if (op == OP_CANCEL)
+			continue;
+		if (op == OP_WATCH || op == OP_ACCEPT) {
+			auto it = _sources.find(id);
+			Source &source = it->second;
+			source.armed = false;
+			if (source.removed) {
+				_sources.erase(it);
+			} else if (op == OP_WATCH) {
+				events.ready.push_back(source.fd);
+				if (res < 0)
+					_sources.erase(it); // дескриптор закрыт; владелец узнает об этом, прочитав его
+			} else if (res >= 0) {
+				events.accepted.emplace_back(source.fd, res);
+			} else if (res != -EINTR && res != -ECONNABORTED && res != -EAGAIN) {
+				__atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+				throw TransportExc("Server accept failure!");
+			}
+			continue;
+		}
+
+		Conn &conn = _conns.at(id);
+		if (op == OP_RECV) {
+			conn.receiving = false;
+			if (conn.closing)
+				try_close(id);
+			else if (res > 0)
+				conn.used += res;
+			else
+				report_broken(conn, events); // клиент закрыл соединение или ошибка
+		} else {
+			complete_send(id, conn, res, events);
+		}
+	}
+	__atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Ядро возвращает отправки одной цепочки по порядку, а после неполной или неудачной - отменяет остальные. */
+void UringLoop::complete_send(uint64_t id, Conn &conn, int res, Events &events)
+{
+	--conn.sending;
+	if (conn.cursor == 0) {
+		Out &out = conn.out.front();
+		if (res >= 0 && size_t(res) == out.len - out.offset) {
+			release(out);
+			conn.out.pop_front();
+		} else if (res > 0) {
+			out.offset += res;
+			conn.cursor = 1;
+		} else {
+			conn.failed = true;
+			conn.cursor = 1;
+			report_broken(conn, events);
+		}
+	} else {
+		++conn.cursor;
+	}
+	if (conn.sending > 0)
+		return;
+	conn.cursor = 0;
+	if (conn.failed) {
+		for (Out &out : conn.out)
+			release(out);
+		conn.out.clear();
+	}
+	if (!conn.out.empty())
+		_dirty.push_back(id);
+	try_close(id);
+}
+
+long UringLoop::query_size(const Conn &conn)
+{
+	return frame_size(std::string_view(conn.in.data(), conn.used));
+}
+
+void UringLoop::release(Out &out)
+{
+	if (out.buffer >= 0)
+		_free_buffers.push_back(out.buffer);
+	out.buffer = -1;
+}
+
+/*
+ * Пока клиент на паузе, сервер ещё держит его сессию занятой отложенным ответом, поэтому о
+ * разрыве (например, неудачной отправке прежнего ответа) сообщается, когда пауза закончится.
+ */
+void UringLoop::report_broken(Conn &conn, Events &events)
+{
+	conn.broken = true;
+	if (conn.listening && !conn.closing && !conn.reported) {
+		events.broken.push_back(conn.fd);
+		conn.reported = true;
+	}
+}
+
+void UringLoop::try_close(uint64_t id)
+{
+	auto it = _conns.find(id);
+	Conn &conn = it->second;
+	if (!conn.closing || conn.receiving || conn.sending > 0 || (!conn.out.empty() && !conn.failed))
+		return;
+	if (close(conn.fd) < 0)
+		perror("Server cannot close socket");
+	for (Out &out : conn.out)
+		release(out);
+	_conns.erase(it);
+}
+
+/* ----------------------------------------PUBLIC METHODS---------------------------------------- */
+
+UringLoop::UringLoop()
+{
+	io_uring_params params{};
+	params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+	_ring_fd = uring_setup(URING_ENTRIES, &params);
+	if (_ring_fd < 0 && errno == EINVAL) { // флаги появились в 5.18-6.0, без них тоже можно
+		params = io_uring_params{};
+		_ring_fd = uring_setup(URING_ENTRIES, &params);
+	}
+	if (_ring_fd < 0)
+		throw TransportExcSetup("Transport: io_uring is not available!");
+	unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RW_CUR_POS;
+	if ((params.features & required) != required) {
+		close(_ring_fd);
+		throw TransportExcSetup("Transport: the kernel io_uring is too old!");
+	}
+
+	_ring_size = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+								  params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+	_ring = mmap(nullptr, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+	_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+	if (_ring == MAP_FAILED || sqes == MAP_FAILED) {
+		if (_ring != MAP_FAILED)
+			munmap(_ring, _ring_size);
+		if (sqes != MAP_FAILED)
+			munmap(sqes, _sqes_size);
+		close(_ring_fd);
+		throw TransportExcSetup("Transport: cannot map the io_uring queues!");
+	}
+	char *ring = static_cast<char*>(_ring);
+	_sqes = static_cast<io_uring_sqe*>(sqes);
+	_sq_head = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+	_sq_tail = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+	_sq_array = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+	_sq_mask = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+	_sq_entries = params.sq_entries;
+	_cq_head = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+	_cq_tail = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+	_cq_mask = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+	_cqes = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+
+	/* Без зарегистрированных буферов (например, не хватило лимита памяти) ответы уходят через send. */
+	size_t total = size_t(URING_SEND_BUFFERS) * URING_SEND_BUFFER_SIZE;
+	void *buffers = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffers != MAP_FAILED) {
+		std::vector<iovec> iov(URING_SEND_BUFFERS);
+		for (int i = 0; i < URING_SEND_BUFFERS; ++i)
+			iov[i] = {static_cast<char*>(buffers) + size_t(i) * URING_SEND_BUFFER_SIZE, URING_SEND_BUFFER_SIZE};
+		if (uring_register(_ring_fd, IORING_REGISTER_BUFFERS, iov.data(), URING_SEND_BUFFERS) == 0) {
+			_buffers = static_cast<char*>(buffers);
+			for (int i = URING_SEND_BUFFERS - 1; i >= 0; --i)
+				_free_buffers.push_back(i);
+		} else {
+			munmap(buffers, total);
+		}
+	}
+	/* write в сокет, закрытый клиентом, в отличие от send не принимает MSG_NOSIGNAL. */
+	signal(SIGPIPE, SIG_IGN);
+}
+
+UringLoop::~UringLoop()
+{
+	/* Ответы, которые сервер уже отдал (например, на shutdown), должны дойти до клиентов. */
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(URING_FLUSH_MS);
+	Events events;
+	try {
+		arm();
+		while (true) {
+			bool sending = false;
+			for (const auto &[id, conn] : _conns)
+				sending |= conn.sending > 0 || !conn.out.empty();
+			int left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if (!sending || left <= 0)
+				break;
+			enter(1, left);
+			reap(events);
+			arm();
+		}
+	} catch (const TransportExc &e) {
+		std::cout << e.what() << std::endl;
+	}
+
+	close(_ring_fd); // ядро отменяет оставшиеся заявки
+	for (const auto &[id, source] : _sources)
+		if (source.op == OP_ACCEPT && close(source.fd) < 0)
+			perror("Server cannot close socket");
+	for (const auto &[id, conn] : _conns)
+		if (close(conn.fd) < 0)
+			perror("Server cannot close socket");
+	munmap(_ring, _ring_size);
+	munmap(_sqes, _sqes_size);
+	if (_buffers != nullptr)
+		munmap(_buffers, size_t(URING_SEND_BUFFERS) * URING_SEND_BUFFER_SIZE);
+}
+
+void UringLoop::watch(int fd)
+{
+	_sources.emplace(_next_id++, Source{fd, OP_WATCH});
+}
+
+void UringLoop::unwatch(int fd)
+{
+	for (auto it = _sources.begin(); it != _sources.end(); ++it) {
+		Source &source = it->second;
+		if (source.op != OP_WATCH || source.fd != fd || source.removed)
+			continue;
+		if (!source.armed) {
+			_sources.erase(it);
+		} else {
+			get_sqe(IORING_OP_POLL_REMOVE, -1, tag(0, OP_CANCEL))->addr = tag(it->first, OP_WATCH);
+			source.removed = true;
+		}
+		return;
+	}
+}
+
+void UringLoop::add_listener(int fd)
+{
+	_sources.emplace(_next_id++, Source{fd, OP_ACCEPT});
+}
+
+void UringLoop::add_client(int fd)
+{
+	uint64_t id = _next_id++;
+	_conns.emplace(id, Conn(fd));
+	_client_ids[fd] = id;
+	++_clients;
+}
+
+void UringLoop::remove_client(int fd)
+{
+	auto it = _client_ids.find(fd);
+	if (it == _client_ids.end())
+		return;
+	uint64_t id = it->second;
+	_client_ids.erase(it);
+	--_clients;
+	Conn &conn = _conns.at(id);
+	conn.closing = true;
+	if (conn.receiving)
+		get_sqe(IORING_OP_ASYNC_CANCEL, -1, tag(0, OP_CANCEL))->addr = tag(id, OP_RECV);
+	try_close(id);
+}
+
+void UringLoop::pause(int fd, bool listen)
+{
+	auto it = _client_ids.find(fd);
+	if (it != _client_ids.end())
+		_conns.at(it->second).listening = listen;
+}
+
+void UringLoop::wait(int timeout, Events &events)
+{
+	events.clear();
+	arm();
+	/* Если в буферах уже есть запросы, ждать нечего: только отдаём заявки и забираем готовое. */
+	bool backlog = false;
+	for (const auto &[id, conn] : _conns)
+		backlog |= conn.listening && !conn.closing && !conn.broken && query_size(conn) != 0;
+	enter(backlog ? 0 : 1, timeout);
+	reap(events);
+
+	for (auto &[id, conn] : _conns) {
+		if (!conn.listening || conn.closing)
+			continue;
+		if (conn.broken) {
+			report_broken(conn, events); // если соединение оборвалось на паузе
+			continue;
+		}
+		long size = query_size(conn);
+		if (size < 0)
+			report_broken(conn, events);
+		if (size <= 0)
+			continue;
+		events.next_query(conn.fd).assign(conn.in.data() + sizeof(int), size - sizeof(int));
+		std::memmove(conn.in.data(), conn.in.data() + size, conn.used - size);
+		conn.used -= size;
+	}
+}
+
+void UringLoop::send(int fd, std::string_view data)
+{
+	auto it = _client_ids.find(fd);
+	if (it == _client_ids.end())
+		return;
+	Conn &conn = _conns.at(it->second);
+	if (conn.failed)
+		return;
+	if (_buffers != nullptr && data.size() <= URING_SEND_BUFFER_SIZE && !_free_buffers.empty()) {
+		int buffer = _free_buffers.back();
+		_free_buffers.pop_back();
+		std::memcpy(_buffers + size_t(buffer) * URING_SEND_BUFFER_SIZE, data.data(), data.size());
+		conn.out.push_back({buffer, {}, data.size()});
+	} else {
+		conn.out.push_back({-1, std::string(data), data.size()});
+	}
+	if (conn.sending == 0 && conn.out.size() == 1)
+		_dirty.push_back(it->second);
+}
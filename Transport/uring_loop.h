@@ -0,0 +1,113 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+#include <linux/io_uring.h>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include "io_loop.h"
+
+#define URING_ENTRIES 256					// размер очереди заявок
+#define URING_RECV_CHUNK (16 * 1024)		// сколько места в буфере клиента подставляется под recv
+#define URING_SEND_BUFFERS 64				// зарегистрированных в ядре буферов для ответов
+#define URING_SEND_BUFFER_SIZE (64 * 1024)	// ответ длиннее отправляется из обычной памяти
+#define URING_MAX_CHAIN 16					// ответов одному клиенту в одной цепочке отправок
+#define URING_FLUSH_MS 1000					// сколько при закрытии ждать отправки оставшихся ответов
+
+/*
+ * Цикл на io_uring. Приём соединений, ожидание наблюдаемых дескрипторов, чтение от клиентов и
+ * отправка ответов - заявки в общей с ядром очереди, и все заявки итерации вместе с ожиданием
+ * результатов уходят в ядро одним системным вызовом io_uring_enter. От клиента принимается
+ * столько, сколько пришло, и запросы выделяются из буфера; следующий recv ставится, только когда
+ * целых запросов в буфере не осталось, а клиент не на паузе. Ответы копируются в
+ * зарегистрированные буферы (или, если свободных нет либо ответ велик, в обычную память), и ответы
+ * одному клиенту отправляются связанной цепочкой, что сохраняет их порядок; недописанный хвост
+ * уходит следующей цепочкой.
+ */
+class UringLoop : public IoLoop
+{
+  private:
+	typedef enum { OP_WATCH, OP_ACCEPT, OP_RECV, OP_SEND, OP_CANCEL } Op;
+
+	/* Наблюдаемый дескриптор или слушающий сокет. */
+	struct Source {
+	  int fd;
+	  Op op;				// OP_WATCH или OP_ACCEPT
+	  bool armed = false;	// заявка в ядре
+	  bool removed = false;	// unwatch(): удалить, когда ядро вернёт заявку
+	};
+	/* Ответ в очереди клиента. */
+	struct Out {
+	  int buffer;			// номер зарегистрированного буфера или -1
+	  std::string heap;		// ответ, если буфер не зарегистрирован
+	  size_t len;
+	  size_t offset = 0;	// сколько уже отправлено
+	};
+	struct Conn {
+	  int fd;
+	  std::string in;			// принятое от клиента; занято первые used байт
+	  size_t used = 0;
+	  bool listening = true;
+	  bool receiving = false;	// recv в ядре
+	  bool closing = false;		// сервер закрыл соединение, осталось отправить ответы
+	  bool broken = false;		// соединение оборвалось
+	  bool reported = false;	// о разрыве сообщено серверу (клиенту на паузе - только после паузы)
+	  bool failed = false;		// отправка не удалась, очередь ответов выбрасывается
+	  std::deque<Out> out;
+	  size_t sending = 0;		// отправок в ядре
+	  size_t cursor = 0;		// позиция в out отправки, которую ядро вернёт следующей
+
+	  explicit Conn(int fd) : fd(fd) {}
+	};
+
+	int _ring_fd = -1;
+	void *_ring = nullptr;
+	size_t _ring_size = 0;
+	io_uring_sqe *_sqes = nullptr;
+	size_t _sqes_size = 0;
+	unsigned *_sq_head, *_sq_tail, *_sq_array, _sq_mask, _sq_entries;
+	unsigned *_cq_head, *_cq_tail, _cq_mask;
+	io_uring_cqe *_cqes;
+	unsigned _to_submit = 0;
+
+	char *_buffers = nullptr;		// URING_SEND_BUFFERS буферов подряд (nullptr - не зарегистрированы)
+	std::vector<int> _free_buffers;
+
+	uint64_t _next_id = 1;
+	std::unordered_map<uint64_t, Source> _sources;
+	std::unordered_map<uint64_t, Conn> _conns;
+	std::unordered_map<int, uint64_t> _client_ids;	// сокет открытого клиента -> его номер
+	std::vector<uint64_t> _dirty;					// клиенты, у которых есть неотправленные ответы
+
+	static uint64_t tag(uint64_t id, Op op) { return id << 3 | op; }
+	io_uring_sqe* get_sqe(uint8_t opcode, int fd, uint64_t user_data);
+	/* Отдаёт заявки ядру и ждёт хотя бы wait_nr результатов не дольше timeout мс. */
+	void enter(unsigned wait_nr, int timeout);
+	void arm();
+	void reap(Events &events);
+	void complete_send(uint64_t id, Conn &conn, int res, Events &events);
+	/* Размер первого запроса в буфере вместе с длиной (0 - целого запроса нет, -1 - мусор). */
+	static long query_size(const Conn &conn);
+	void release(Out &out);
+	void report_broken(Conn &conn, Events &events);
+	/* Закрывает сокет клиента, которого закрыл сервер, когда ядро вернуло все его заявки. */
+	void try_close(uint64_t id);
+
+  public:
+	UringLoop();
+	UringLoop(const UringLoop &) = delete;
+	UringLoop& operator=(const UringLoop &) = delete;
+	~UringLoop() override;
+
+	const char* name() const override { return "io_uring"; }
+	void watch(int fd) override;
+	void unwatch(int fd) override;
+	void add_listener(int fd) override;
+	void add_client(int fd) override;
+	void remove_client(int fd) override;
+	void pause(int fd, bool listen) override;
+	void wait(int timeout, Events &events) override;
+	void send(int fd, std::string_view data) override;
+};
+
+#endif // URING_LOOP_H
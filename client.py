@@ -1,11 +1,13 @@
 import socket
 import struct
+import sys
 
 class ProtocolCodes:
     SUCCESS = 0     # Была выполнена одна из команд insert, remove, select, reselect
     PRINT_DATA = 1  # Была выполнена команда print, нужно принять данные
     QUIT = 2        # Была выполнена команда stop или shutdown, нужно прекратить работу
     ERROR = 3       # Возникла ошибка
+    PREPARED = 4    # Была выполнена команда prepare, нужно принять номер запроса
 
 def getStrFromServer(sock, len):
     data = sock.recv(len, socket.MSG_WAITALL)
@@ -18,13 +20,17 @@ def getIntFromServer(sock):
 
 def sendStrToServer(sock, query):
     n = len(query)
-    packed_data = struct.pack("i", n)
-    sock.sendall(packed_data)
-    packed_data = struct.pack(str(n) + "s", query.encode())
+    packed_data = struct.pack("i" + str(n) + "s", n, query.encode())
     sock.sendall(packed_data)
 
-sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-sock.connect(("localhost", 5555))
+# Аргумент - порт (реплики слушают другие порты) или путь к Unix-сокету сервера (server.PORT.sock)
+address = sys.argv[1] if len(sys.argv) > 1 else "5555"
+if address.isdigit():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.connect(("localhost", int(address)))
+else:
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(address)
 print("Welcome!\n")
 while True:
     query = input(">> ")
@@ -49,6 +55,8 @@ while True:
         elif code == ProtocolCodes.ERROR:
             length = getIntFromServer(sock)
             print('\t' + getStrFromServer(sock, length), end='\n')
+        elif code == ProtocolCodes.PREPARED:
+            print("\tYour query was prepared with handle " + str(getIntFromServer(sock)))
     except Exception as e:
         print("Something went wrong! The server has probably been down.")
         break